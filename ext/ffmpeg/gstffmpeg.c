@@ -35,48 +35,65 @@
 #include <libavformat/avformat.h>
 #endif
 
+#ifdef HAVE_ORC
+#include <orc/orc.h>
+#endif
+
 #include "gstffmpeg.h"
 #include "gstffmpegutils.h"
 
 GST_DEBUG_CATEGORY (ffmpeg_debug);
 
-static GStaticMutex gst_avcodec_mutex = G_STATIC_MUTEX_INIT;
-
-
+/* All avcodec_open/close calls are serialized on the single codec lock of
+ * libavcodec, which uses the lock manager we register below. Codecs share
+ * static tables that are initialized on first open, so that lock can't be
+ * made per codec; opens of different codecs still run one after the other.
+ * These wrappers only avoid taking a second lock of our own around it. */
 int
 gst_ffmpeg_avcodec_open (AVCodecContext * avctx, AVCodec * codec)
 {
-  int ret;
-
-  g_static_mutex_lock (&gst_avcodec_mutex);
-  ret = avcodec_open (avctx, codec);
-  g_static_mutex_unlock (&gst_avcodec_mutex);
-
-  return ret;
+  return avcodec_open (avctx, codec);
 }
 
 int
 gst_ffmpeg_avcodec_close (AVCodecContext * avctx)
 {
-  int ret;
+  /* joining the worker threads only concerns this context, so do it before
+   * avcodec_close() takes the codec lock */
+  if (avctx->thread_opaque)
+    avcodec_thread_free (avctx);
 
-  g_static_mutex_lock (&gst_avcodec_mutex);
-  ret = avcodec_close (avctx);
-  g_static_mutex_unlock (&gst_avcodec_mutex);
-
-  return ret;
+  return avcodec_close (avctx);
 }
 
+/* av_find_stream_info opens and closes decoders internally. Those calls take
+ * the codec lock of libavcodec themselves, so there is no need to hold
+ * another lock while the probing is running. */
 int
 gst_ffmpeg_av_find_stream_info (AVFormatContext * ic)
 {
-  int ret;
-
-  g_static_mutex_lock (&gst_avcodec_mutex);
-  ret = av_find_stream_info (ic);
-  g_static_mutex_unlock (&gst_avcodec_mutex);
+  return av_find_stream_info (ic);
+}
 
-  return ret;
+static int
+gst_ffmpeg_lockmgr (void **mutex, enum AVLockOp op)
+{
+  switch (op) {
+    case AV_LOCK_CREATE:
+      *mutex = g_mutex_new ();
+      return *mutex == NULL;
+    case AV_LOCK_OBTAIN:
+      g_mutex_lock ((GMutex *) * mutex);
+      return 0;
+    case AV_LOCK_RELEASE:
+      g_mutex_unlock ((GMutex *) * mutex);
+      return 0;
+    case AV_LOCK_DESTROY:
+      g_mutex_free ((GMutex *) * mutex);
+      *mutex = NULL;
+      return 0;
+  }
+  return 1;
 }
 
 #ifndef GST_DISABLE_GST_DEBUG
@@ -136,7 +153,14 @@ plugin_init (GstPlugin * plugin)
 
   gst_ffmpeg_init_pix_fmt_info ();
 
+#ifdef HAVE_ORC
+  orc_init ();
+#endif
+
   av_register_all ();
+  av_lockmgr_register (gst_ffmpeg_lockmgr);
+
+  gst_ffmpeg_caps_cache_init (gst_plugin_get_filename (plugin));
 
   gst_ffmpegenc_register (plugin);
   gst_ffmpegdec_register (plugin);
@@ -151,6 +175,8 @@ plugin_init (GstPlugin * plugin)
 #endif
   gst_ffmpegaudioresample_register (plugin);
 
+  gst_ffmpeg_caps_cache_finish ();
+
   register_protocol (&gstreamer_protocol);
   register_protocol (&gstpipe_protocol);
 
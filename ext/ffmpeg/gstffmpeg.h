@@ -63,6 +63,19 @@ G_END_DECLS
 extern URLProtocol gstreamer_protocol;
 extern URLProtocol gstpipe_protocol;
 
+GstFlowReturn gst_ffmpeg_url_flush (ByteIOContext * pb);
+gboolean gst_ffmpeg_url_get_cache_stats (ByteIOContext * pb, guint64 * hits,
+    guint64 * misses);
+
+/* defaults for the read-ahead cache of gstreamer:// in read mode, changed
+ * with gstreamer://<pad>?blocksize=<bytes>&blocks=<n> */
+#define GST_FFMPEG_URL_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define GST_FFMPEG_URL_DEFAULT_BLOCKS 8
+
+/* default size of the chunks pushed downstream by gstreamer:// in write
+ * mode, changed with gstreamer://<pad>?writesize=<bytes> */
+#define GST_FFMPEG_URL_DEFAULT_WRITE_SIZE (256 * 1024)
+
 /* use GST_FFMPEG URL_STREAMHEADER with URL_WRONLY if the first
  * buffer should be used as streamheader property on the pad's caps. */
 #define GST_FFMPEG_URL_STREAMHEADER 16
@@ -30,13 +30,55 @@
 #include <libavcodec/avcodec.h>
 #endif
 
+#include <math.h>
+#include <string.h>
+
 #include <gst/gst.h>
 #include <gst/base/gstbasetransform.h>
-#include <gst/video/video.h>
+
+#ifdef HAVE_ORC
+#include <orc/orc.h>
+#endif
 
 #include "gstffmpeg.h"
 #include "gstffmpegcodecmap.h"
 
+/* Windowed sinc polyphase resampler working on float samples. The filter
+ * parameters are the ones audio_resample_init() uses: 16 taps at the
+ * lower of both rates, a cutoff of 0.8 and a kaiser window with beta 9. */
+#define FILTER_SIZE 16
+#define CUTOFF 0.8
+#define KAISER_BETA 9
+
+/* upper bound on the number of filters in a bank, ratios that would need
+ * more use the nearest lower phase */
+#define MAX_PHASES 1024
+
+typedef enum
+{
+  GST_FFMPEGAUDIORESAMPLE_S16,
+  GST_FFMPEGAUDIORESAMPLE_S32,
+  GST_FFMPEGAUDIORESAMPLE_F32
+} GstFFMpegAudioResampleFormat;
+
+/* A filter bank depends on the rates only, so all instances converting
+ * between the same rates share one. */
+typedef struct _GstFFMpegResampleFilter
+{
+  gint refcount;
+
+  /* rates divided by their gcd, the resampler steps in_rate / out_rate
+   * input samples per output sample */
+  gint in_rate, out_rate;
+
+  gint phases;
+  /* coefficients per phase, padded with zeros to a multiple of 4 */
+  gint taps;
+  /* taps before the center one */
+  gint center;
+  gfloat *bank;
+} GstFFMpegResampleFilter;
+
 typedef struct _GstFFMpegAudioResample
 {
   GstBaseTransform element;
@@ -44,9 +86,26 @@ typedef struct _GstFFMpegAudioResample
   GstPad *sinkpad, *srcpad;
 
   gint in_rate, out_rate;
-  gint in_channels, out_channels;
+  gint channels;
+  GstFFMpegAudioResampleFormat format;
+  gint unit_size;
+
+  GstFFMpegResampleFilter *filter;
 
-  ReSampleContext *res;
+  /* planar input history, history_size floats per channel of which the
+   * first history_len are valid */
+  gfloat *history;
+  gint history_len, history_size;
+
+  /* position of the next output sample: the first tap is at history
+   * sample index, the phase is frac / filter->out_rate */
+  gint index, frac;
+
+  gfloat *temp;
+  gint temp_size;
+
+  GstClockTime timestamp;
+  guint64 samples_out;
 } GstFFMpegAudioResample;
 
 typedef struct _GstFFMpegAudioResampleClass
@@ -67,18 +126,26 @@ typedef struct _GstFFMpegAudioResampleClass
 
 GType gst_ffmpegaudioresample_get_type (void);
 
+#define AUDIORESAMPLE_CAPS \
+    "audio/x-raw-int, endianness = (int) BYTE_ORDER, " \
+    "signed = (boolean) true, width = (int) 16, depth = (int) 16, " \
+    "channels = (int) [ 1, MAX ], rate = (int) [ 1, MAX ]; " \
+    "audio/x-raw-int, endianness = (int) BYTE_ORDER, " \
+    "signed = (boolean) true, width = (int) 32, depth = (int) 32, " \
+    "channels = (int) [ 1, MAX ], rate = (int) [ 1, MAX ]; " \
+    "audio/x-raw-float, endianness = (int) BYTE_ORDER, " \
+    "width = (int) 32, channels = (int) [ 1, MAX ], rate = (int) [ 1, MAX ]"
+
 static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS
-    ("audio/x-raw-int, endianness = (int) BYTE_ORDER, signed = (boolean) true, width = (int) 16, depth = (int) 16, channels = (int) { 1 , 2 }, rate = (int) [1, MAX ]")
+    GST_STATIC_CAPS (AUDIORESAMPLE_CAPS)
     );
 
 static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS
-    ("audio/x-raw-int, endianness = (int) BYTE_ORDER, signed = (boolean) true, width = (int) 16, depth = (int) 16, channels = (int) [ 1 , 6 ], rate = (int) [1, MAX ]")
+    GST_STATIC_CAPS (AUDIORESAMPLE_CAPS)
     );
 
 GST_BOILERPLATE (GstFFMpegAudioResample, gst_ffmpegaudioresample,
@@ -95,9 +162,259 @@ static gboolean gst_ffmpegaudioresample_get_unit_size (GstBaseTransform * trans,
     GstCaps * caps, guint * size);
 static gboolean gst_ffmpegaudioresample_set_caps (GstBaseTransform * trans,
     GstCaps * incaps, GstCaps * outcaps);
+static gboolean gst_ffmpegaudioresample_stop (GstBaseTransform * trans);
 static GstFlowReturn gst_ffmpegaudioresample_transform (GstBaseTransform *
     trans, GstBuffer * inbuf, GstBuffer * outbuf);
 
+static GStaticMutex filter_cache_lock = G_STATIC_MUTEX_INIT;
+static GList *filter_cache = NULL;
+
+/* 0th order modified bessel function of the first kind */
+static gdouble
+bessel (gdouble x)
+{
+  gdouble v = 1, lastv = 0, t = 1;
+  gint i;
+
+  x = x * x / 4;
+  for (i = 1; v != lastv; i++) {
+    lastv = v;
+    t *= x / (i * i);
+    v += t;
+  }
+  return v;
+}
+
+static GstFFMpegResampleFilter *
+gst_ffmpegresample_filter_new (gint in_rate, gint out_rate)
+{
+  GstFFMpegResampleFilter *filter;
+  gdouble factor, *tab;
+  gint length, ph, i;
+
+  filter = g_new0 (GstFFMpegResampleFilter, 1);
+  filter->refcount = 1;
+  filter->in_rate = in_rate;
+  filter->out_rate = out_rate;
+  filter->phases = MIN (out_rate, MAX_PHASES);
+
+  /* when downsampling, the cutoff moves down with the output rate */
+  factor = MIN (out_rate * CUTOFF / in_rate, 1.0);
+  length = MAX ((gint) ceil (FILTER_SIZE / factor), 1);
+  filter->taps = (length + 3) & ~3;
+  filter->center = (length - 1) / 2;
+  filter->bank = av_mallocz (filter->phases * filter->taps * sizeof (gfloat));
+
+  tab = g_new (gdouble, length);
+  for (ph = 0; ph < filter->phases; ph++) {
+    gdouble norm = 0;
+
+    for (i = 0; i < length; i++) {
+      gdouble x, y, w;
+
+      x = M_PI * ((gdouble) (i - filter->center) -
+          (gdouble) ph / filter->phases) * factor;
+      y = (x == 0) ? 1.0 : sin (x) / x;
+      w = 2.0 * x / (factor * length * M_PI);
+      y *= bessel (KAISER_BETA * sqrt (MAX (1 - w * w, 0)));
+
+      tab[i] = y;
+      norm += y;
+    }
+    /* normalize so that a constant signal keeps its level */
+    for (i = 0; i < length; i++)
+      filter->bank[ph * filter->taps + i] = tab[i] / norm;
+  }
+  g_free (tab);
+
+  return filter;
+}
+
+static GstFFMpegResampleFilter *
+gst_ffmpegresample_filter_get (gint in_rate, gint out_rate)
+{
+  GstFFMpegResampleFilter *filter = NULL;
+  GList *walk;
+  gint a, b;
+
+  /* reduce the rates */
+  a = in_rate;
+  b = out_rate;
+  while (b) {
+    gint t = a % b;
+
+    a = b;
+    b = t;
+  }
+  in_rate /= a;
+  out_rate /= a;
+
+  g_static_mutex_lock (&filter_cache_lock);
+  for (walk = filter_cache; walk; walk = walk->next) {
+    GstFFMpegResampleFilter *f = walk->data;
+
+    if (f->in_rate == in_rate && f->out_rate == out_rate) {
+      filter = f;
+      filter->refcount++;
+      break;
+    }
+  }
+  if (filter == NULL) {
+    filter = gst_ffmpegresample_filter_new (in_rate, out_rate);
+    filter_cache = g_list_prepend (filter_cache, filter);
+  }
+  g_static_mutex_unlock (&filter_cache_lock);
+
+  return filter;
+}
+
+static void
+gst_ffmpegresample_filter_unref (GstFFMpegResampleFilter * filter)
+{
+  g_static_mutex_lock (&filter_cache_lock);
+  if (--filter->refcount == 0) {
+    filter_cache = g_list_remove (filter_cache, filter);
+    av_free (filter->bank);
+    g_free (filter);
+  }
+  g_static_mutex_unlock (&filter_cache_lock);
+}
+
+#define FILTER_PHASE(filter, frac) \
+    ((filter)->phases == (filter)->out_rate ? (frac) : \
+        (gint) ((gint64) (frac) * (filter)->phases / (filter)->out_rate))
+
+#define ADVANCE(filter, index, frac) G_STMT_START { \
+  (index) += (filter)->in_rate / (filter)->out_rate; \
+  (frac) += (filter)->in_rate % (filter)->out_rate; \
+  if ((frac) >= (filter)->out_rate) { \
+    (frac) -= (filter)->out_rate; \
+    (index)++; \
+  } \
+} G_STMT_END
+
+/* Computes @n output samples of one channel into @dest, the first one with
+ * its first tap at @src[@index] and phase @frac. */
+typedef void (*ResampleChannelFunc) (gfloat * dest, const gfloat * src,
+    const GstFFMpegResampleFilter * filter, gint index, gint frac, gint n);
+
+/* accumulates in the same order as the SSE2 version so that both give the
+ * same result */
+static void
+resample_channel_c (gfloat * dest, const gfloat * src,
+    const GstFFMpegResampleFilter * filter, gint index, gint frac, gint n)
+{
+  gint i, j, k;
+
+  for (i = 0; i < n; i++) {
+    const gfloat *s = src + index;
+    const gfloat *c = filter->bank + FILTER_PHASE (filter, frac) * filter->taps;
+    gfloat acc[4] = { 0, };
+
+    for (j = 0; j < filter->taps; j += 4) {
+      for (k = 0; k < 4; k++)
+        acc[k] += s[j + k] * c[j + k];
+    }
+    dest[i] = (acc[0] + acc[2]) + (acc[1] + acc[3]);
+
+    ADVANCE (filter, index, frac);
+  }
+}
+
+#if defined (__GNUC__) && (defined (HAVE_CPU_I386) || defined (HAVE_CPU_X86_64))
+#define HAVE_SSE2_ASM 1
+
+/* the compiler only knows about the xmm registers when SSE is enabled */
+#ifdef __SSE__
+#define XMM_CLOBBERS(...) __VA_ARGS__
+#else
+#define XMM_CLOBBERS(...)
+#endif
+
+#ifdef HAVE_CPU_X86_64
+#define REG_a "rax"
+#define PTR_SIZE "8"
+#else
+#define REG_a "eax"
+#define PTR_SIZE "4"
+#endif
+
+/* multiplies 4 samples of the history pointer n of the table with 4
+ * coefficients of the filter pointer n + 1 and adds them to acc */
+#define MAC_SSE2(n, acc) \
+    "mov " #n "*" PTR_SIZE "(%[ptrs]), %%" REG_a "    \n\t" \
+    "movups     (%%" REG_a ", %[j]), %%xmm4          \n\t" \
+    "mov (" #n "+1)*" PTR_SIZE "(%[ptrs]), %%" REG_a "\n\t" \
+    "mulps      (%%" REG_a ", %[j]), %%xmm4          \n\t" \
+    "addps           %%xmm4, " acc "                 \n\t"
+
+/* Computes 4 output samples at a time, so that the sums can be reduced
+ * together with a transpose. The history and filter pointers of the 4
+ * samples are passed in a table, there are not enough registers for them
+ * on i386. */
+static void
+resample_channel_sse2 (gfloat * dest, const gfloat * src,
+    const GstFFMpegResampleFilter * filter, gint index, gint frac, gint n)
+{
+  gssize size = filter->taps * sizeof (gfloat);
+  const gfloat *ptrs[8];
+  gfloat out[4];
+  gint i, k;
+
+  for (i = 0; i < n; i += 4) {
+    gfloat *d = (n - i >= 4) ? dest + i : out;
+    gssize j = 0;
+
+    /* the last block repeats its final sample */
+    for (k = 0; k < 4; k++) {
+      ptrs[2 * k] = src + index;
+      ptrs[2 * k + 1] =
+          filter->bank + FILTER_PHASE (filter, frac) * filter->taps;
+      if (i + k + 1 < n)
+        ADVANCE (filter, index, frac);
+    }
+
+    __asm__ __volatile__ (
+        "xorps           %%xmm0, %%xmm0     \n\t"
+        "xorps           %%xmm1, %%xmm1     \n\t"
+        "xorps           %%xmm2, %%xmm2     \n\t"
+        "xorps           %%xmm3, %%xmm3     \n\t"
+        "1:                                 \n\t"
+        MAC_SSE2 (0, "%%xmm0")
+        MAC_SSE2 (2, "%%xmm1")
+        MAC_SSE2 (4, "%%xmm2")
+        MAC_SSE2 (6, "%%xmm3")
+        "add                $16, %[j]       \n\t"
+        "cmp           %[size], %[j]        \n\t"
+        "jb                  1b             \n\t"
+        /* xmm0 = a0+a2 b0+b2 a1+a3 b1+b3, xmm2 = the same for c and d */
+        "movaps          %%xmm0, %%xmm4     \n\t"
+        "unpcklps        %%xmm1, %%xmm0     \n\t"
+        "unpckhps        %%xmm1, %%xmm4     \n\t"
+        "addps           %%xmm4, %%xmm0     \n\t"
+        "movaps          %%xmm2, %%xmm5     \n\t"
+        "unpcklps        %%xmm3, %%xmm2     \n\t"
+        "unpckhps        %%xmm3, %%xmm5     \n\t"
+        "addps           %%xmm5, %%xmm2     \n\t"
+        "movaps          %%xmm0, %%xmm1     \n\t"
+        "movlhps         %%xmm2, %%xmm0     \n\t"
+        "movhlps         %%xmm1, %%xmm2     \n\t"
+        "addps           %%xmm2, %%xmm0     \n\t"
+        "movups          %%xmm0, (%[d])     \n\t"
+        : [j] "+r" (j)
+        : [d] "r" (d), [ptrs] "r" (ptrs), [size] "r" (size)
+        : "%" REG_a, "memory"
+          XMM_CLOBBERS (, "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4",
+            "%xmm5"));
+
+    if (d == out)
+      memcpy (dest + i, out, (n - i) * sizeof (gfloat));
+  }
+}
+#endif /* HAVE_SSE2_ASM */
+
+static ResampleChannelFunc resample_channel = resample_channel_c;
+
 static void
 gst_ffmpegaudioresample_base_init (gpointer g_class)
 {
@@ -118,6 +435,9 @@ gst_ffmpegaudioresample_class_init (GstFFMpegAudioResampleClass * klass)
 {
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+#ifdef HAVE_SSE2_ASM
+  gboolean sse2;
+#endif
 
   gobject_class->finalize = gst_ffmpegaudioresample_finalize;
 
@@ -126,12 +446,28 @@ gst_ffmpegaudioresample_class_init (GstFFMpegAudioResampleClass * klass)
   trans_class->get_unit_size =
       GST_DEBUG_FUNCPTR (gst_ffmpegaudioresample_get_unit_size);
   trans_class->set_caps = GST_DEBUG_FUNCPTR (gst_ffmpegaudioresample_set_caps);
+  trans_class->stop = GST_DEBUG_FUNCPTR (gst_ffmpegaudioresample_stop);
   trans_class->transform =
       GST_DEBUG_FUNCPTR (gst_ffmpegaudioresample_transform);
   trans_class->transform_size =
       GST_DEBUG_FUNCPTR (gst_ffmpegaudioresample_transform_size);
 
   trans_class->passthrough_on_same_caps = TRUE;
+
+#ifdef HAVE_SSE2_ASM
+#ifdef HAVE_ORC
+  sse2 = (orc_target_get_default_flags (orc_target_get_by_name ("sse")) &
+      ORC_TARGET_SSE_SSE2) != 0;
+#elif defined (__SSE2__)
+  sse2 = TRUE;
+#else
+  sse2 = FALSE;
+#endif
+  if (sse2) {
+    GST_DEBUG ("using the SSE2 resampling kernel");
+    resample_channel = resample_channel_sse2;
+  }
+#endif
 }
 
 static void
@@ -142,7 +478,24 @@ gst_ffmpegaudioresample_init (GstFFMpegAudioResample * resample,
 
   gst_pad_set_bufferalloc_function (trans->sinkpad, NULL);
 
-  resample->res = NULL;
+  resample->filter = NULL;
+  resample->history = NULL;
+  resample->temp = NULL;
+}
+
+static void
+gst_ffmpegaudioresample_free (GstFFMpegAudioResample * resample)
+{
+  if (resample->filter != NULL) {
+    gst_ffmpegresample_filter_unref (resample->filter);
+    resample->filter = NULL;
+  }
+  g_free (resample->history);
+  resample->history = NULL;
+  resample->history_len = resample->history_size = 0;
+  g_free (resample->temp);
+  resample->temp = NULL;
+  resample->temp_size = 0;
 }
 
 static void
@@ -150,8 +503,7 @@ gst_ffmpegaudioresample_finalize (GObject * object)
 {
   GstFFMpegAudioResample *resample = GST_FFMPEGAUDIORESAMPLE (object);
 
-  if (resample->res != NULL)
-    audio_resample_close (resample->res);
+  gst_ffmpegaudioresample_free (resample);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -161,44 +513,63 @@ gst_ffmpegaudioresample_transform_caps (GstBaseTransform * trans,
     GstPadDirection direction, GstCaps * caps)
 {
   GstCaps *retcaps;
-  GstStructure *struc;
+  guint i;
 
   retcaps = gst_caps_copy (caps);
-  struc = gst_caps_get_structure (retcaps, 0);
-  gst_structure_set (struc, "rate", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+  for (i = 0; i < gst_caps_get_size (retcaps); i++) {
+    GstStructure *struc = gst_caps_get_structure (retcaps, i);
+
+    gst_structure_set (struc, "rate", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+  }
 
   GST_LOG_OBJECT (trans, "returning caps %" GST_PTR_FORMAT, retcaps);
 
   return retcaps;
 }
 
+static gboolean
+gst_ffmpegaudioresample_parse_caps (GstCaps * caps, gint * rate,
+    gint * channels, GstFFMpegAudioResampleFormat * format, gint * unit_size)
+{
+  GstStructure *structure = gst_caps_get_structure (caps, 0);
+  gint width;
+
+  if (!gst_structure_get_int (structure, "rate", rate) ||
+      !gst_structure_get_int (structure, "channels", channels) ||
+      !gst_structure_get_int (structure, "width", &width))
+    return FALSE;
+
+  if (gst_structure_has_name (structure, "audio/x-raw-float"))
+    *format = GST_FFMPEGAUDIORESAMPLE_F32;
+  else if (width == 32)
+    *format = GST_FFMPEGAUDIORESAMPLE_S32;
+  else
+    *format = GST_FFMPEGAUDIORESAMPLE_S16;
+
+  *unit_size = width / 8 * *channels;
+
+  return *rate > 0 && *channels > 0;
+}
+
 static gboolean
 gst_ffmpegaudioresample_transform_size (GstBaseTransform * trans,
     GstPadDirection direction, GstCaps * caps, guint size, GstCaps * othercaps,
     guint * othersize)
 {
-  gint inrate, outrate;
-  gint inchanns, outchanns;
-  GstStructure *ins, *outs;
-  gboolean ret;
-  guint64 conv;
-
-  ins = gst_caps_get_structure (caps, 0);
-  outs = gst_caps_get_structure (othercaps, 0);
-
-  /* Get input/output sample rate and channels */
-  ret = gst_structure_get_int (ins, "rate", &inrate);
-  ret &= gst_structure_get_int (ins, "channels", &inchanns);
-  ret &= gst_structure_get_int (outs, "rate", &outrate);
-  ret &= gst_structure_get_int (outs, "channels", &outchanns);
-
-  if (!ret)
+  GstFFMpegAudioResampleFormat format;
+  gint rate, otherrate, channels, unit, otherunit;
+  guint64 frames;
+
+  if (!gst_ffmpegaudioresample_parse_caps (caps, &rate, &channels, &format,
+          &unit) ||
+      !gst_ffmpegaudioresample_parse_caps (othercaps, &otherrate, &channels,
+          &format, &otherunit))
     return FALSE;
 
-  conv = gst_util_uint64_scale (size, outrate * outchanns, inrate * inchanns);
-  /* Adding padding to the output buffer size, since audio_resample's internal
-   * methods might write a bit further. */
-  *othersize = (guint) conv + 64;
+  /* the history holds less than a filter length of input, which yields at
+   * most one sample more than the buffer itself, round up for another */
+  frames = gst_util_uint64_scale (size / unit, otherrate, rate) + 2;
+  *othersize = frames * otherunit;
 
   GST_DEBUG_OBJECT (trans, "Transformed size from %d to %d", size, *othersize);
 
@@ -209,80 +580,269 @@ static gboolean
 gst_ffmpegaudioresample_get_unit_size (GstBaseTransform * trans, GstCaps * caps,
     guint * size)
 {
-  gint channels;
-  GstStructure *structure;
-  gboolean ret;
+  GstFFMpegAudioResampleFormat format;
+  gint rate, channels, unit;
 
   g_assert (size);
 
-  structure = gst_caps_get_structure (caps, 0);
-  ret = gst_structure_get_int (structure, "channels", &channels);
-  g_return_val_if_fail (ret, FALSE);
+  if (!gst_ffmpegaudioresample_parse_caps (caps, &rate, &channels, &format,
+          &unit))
+    return FALSE;
 
-  *size = 2 * channels;
+  *size = unit;
 
   return TRUE;
 }
 
+/* makes room for @frames more samples per channel in the history */
+static void
+gst_ffmpegaudioresample_ensure_history (GstFFMpegAudioResample * resample,
+    gint frames)
+{
+  gfloat *history;
+  gint size, c;
+
+  if (resample->history_len + frames <= resample->history_size)
+    return;
+
+  size = resample->history_len + frames;
+  history = g_new (gfloat, size * resample->channels);
+  for (c = 0; c < resample->channels && resample->history_len > 0; c++) {
+    memcpy (history + c * size,
+        resample->history + c * resample->history_size,
+        resample->history_len * sizeof (gfloat));
+  }
+  g_free (resample->history);
+  resample->history = history;
+  resample->history_size = size;
+}
+
+/* starts over with a history of silence, so that the first output sample is
+ * centered on the first input sample */
+static void
+gst_ffmpegaudioresample_reset (GstFFMpegAudioResample * resample)
+{
+  gint c;
+
+  resample->history_len = 0;
+  gst_ffmpegaudioresample_ensure_history (resample, resample->filter->center);
+  for (c = 0; c < resample->channels; c++) {
+    memset (resample->history + c * resample->history_size, 0,
+        resample->filter->center * sizeof (gfloat));
+  }
+  resample->history_len = resample->filter->center;
+  resample->index = 0;
+  resample->frac = 0;
+
+  resample->timestamp = GST_CLOCK_TIME_NONE;
+  resample->samples_out = 0;
+}
+
 static gboolean
 gst_ffmpegaudioresample_set_caps (GstBaseTransform * trans, GstCaps * incaps,
     GstCaps * outcaps)
 {
   GstFFMpegAudioResample *resample = GST_FFMPEGAUDIORESAMPLE (trans);
-  GstStructure *instructure = gst_caps_get_structure (incaps, 0);
-  GstStructure *outstructure = gst_caps_get_structure (outcaps, 0);
+  GstFFMpegAudioResampleFormat outformat;
+  gint outchannels, outunit;
 
   GST_LOG_OBJECT (resample, "incaps:%" GST_PTR_FORMAT, incaps);
 
   GST_LOG_OBJECT (resample, "outcaps:%" GST_PTR_FORMAT, outcaps);
 
-  if (!gst_structure_get_int (instructure, "channels", &resample->in_channels))
+  if (!gst_ffmpegaudioresample_parse_caps (incaps, &resample->in_rate,
+          &resample->channels, &resample->format, &resample->unit_size))
     return FALSE;
-  if (!gst_structure_get_int (instructure, "rate", &resample->in_rate))
+  if (!gst_ffmpegaudioresample_parse_caps (outcaps, &resample->out_rate,
+          &outchannels, &outformat, &outunit))
     return FALSE;
 
-  if (!gst_structure_get_int (outstructure, "channels",
-          &resample->out_channels))
-    return FALSE;
-  if (!gst_structure_get_int (outstructure, "rate", &resample->out_rate))
+  /* only the rate is converted */
+  if (outchannels != resample->channels || outformat != resample->format)
     return FALSE;
 
-  resample->res =
-      audio_resample_init (resample->out_channels, resample->in_channels,
-      resample->out_rate, resample->in_rate);
-  if (resample->res == NULL)
-    return FALSE;
+  gst_ffmpegaudioresample_free (resample);
+  resample->filter =
+      gst_ffmpegresample_filter_get (resample->in_rate, resample->out_rate);
+
+  GST_DEBUG_OBJECT (resample, "%d -> %d Hz, %d phases of %d taps",
+      resample->in_rate, resample->out_rate, resample->filter->phases,
+      resample->filter->taps);
+
+  gst_ffmpegaudioresample_reset (resample);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ffmpegaudioresample_stop (GstBaseTransform * trans)
+{
+  gst_ffmpegaudioresample_free (GST_FFMPEGAUDIORESAMPLE (trans));
 
   return TRUE;
 }
 
+/* appends @frames interleaved input samples to the planar history */
+static void
+gst_ffmpegaudioresample_deinterleave (GstFFMpegAudioResample * resample,
+    const guint8 * data, gint frames)
+{
+  gint channels = resample->channels;
+  gint c, i;
+
+  for (c = 0; c < channels; c++) {
+    gfloat *dest = resample->history + c * resample->history_size +
+        resample->history_len;
+
+    switch (resample->format) {
+      case GST_FFMPEGAUDIORESAMPLE_S16:{
+        const gint16 *src = (const gint16 *) data + c;
+
+        for (i = 0; i < frames; i++)
+          dest[i] = src[i * channels];
+        break;
+      }
+      case GST_FFMPEGAUDIORESAMPLE_S32:{
+        const gint32 *src = (const gint32 *) data + c;
+
+        for (i = 0; i < frames; i++)
+          dest[i] = src[i * channels];
+        break;
+      }
+      case GST_FFMPEGAUDIORESAMPLE_F32:{
+        const gfloat *src = (const gfloat *) data + c;
+
+        for (i = 0; i < frames; i++)
+          dest[i] = src[i * channels];
+        break;
+      }
+    }
+  }
+  resample->history_len += frames;
+}
+
+/* writes @frames samples of channel @c from @src into the interleaved
+ * output, rounding and clipping for the integer formats */
+static void
+gst_ffmpegaudioresample_interleave (GstFFMpegAudioResample * resample,
+    guint8 * data, const gfloat * src, gint c, gint frames)
+{
+  gint channels = resample->channels;
+  gint i;
+
+  switch (resample->format) {
+    case GST_FFMPEGAUDIORESAMPLE_S16:{
+      gint16 *dest = (gint16 *) data + c;
+
+      for (i = 0; i < frames; i++) {
+        glong v = lrintf (src[i]);
+
+        dest[i * channels] = CLAMP (v, G_MININT16, G_MAXINT16);
+      }
+      break;
+    }
+    case GST_FFMPEGAUDIORESAMPLE_S32:{
+      gint32 *dest = (gint32 *) data + c;
+
+      for (i = 0; i < frames; i++) {
+        if (src[i] >= 2147483648.0f)
+          dest[i * channels] = G_MAXINT32;
+        else if (src[i] <= -2147483648.0f)
+          dest[i * channels] = G_MININT32;
+        else
+          dest[i * channels] = lrintf (src[i]);
+      }
+      break;
+    }
+    case GST_FFMPEGAUDIORESAMPLE_F32:{
+      gfloat *dest = (gfloat *) data + c;
+
+      for (i = 0; i < frames; i++)
+        dest[i * channels] = src[i];
+      break;
+    }
+  }
+}
+
 static GstFlowReturn
 gst_ffmpegaudioresample_transform (GstBaseTransform * trans, GstBuffer * inbuf,
     GstBuffer * outbuf)
 {
   GstFFMpegAudioResample *resample = GST_FFMPEGAUDIORESAMPLE (trans);
-  gint nbsamples;
-  gint ret;
+  GstFFMpegResampleFilter *filter = resample->filter;
+  gint nbsamples, maxsamples, ret;
+  gint index, frac, c;
+
+  if (G_UNLIKELY (filter == NULL))
+    return GST_FLOW_NOT_NEGOTIATED;
 
-  gst_buffer_copy_metadata (outbuf, inbuf, GST_BUFFER_COPY_TIMESTAMPS);
-  nbsamples = GST_BUFFER_SIZE (inbuf) / (2 * resample->in_channels);
+  nbsamples = GST_BUFFER_SIZE (inbuf) / resample->unit_size;
+  maxsamples = GST_BUFFER_SIZE (outbuf) / resample->unit_size;
 
   GST_LOG_OBJECT (resample, "input buffer duration:%" GST_TIME_FORMAT,
       GST_TIME_ARGS (GST_BUFFER_DURATION (inbuf)));
 
-  GST_DEBUG_OBJECT (resample,
-      "audio_resample(ctx, output:%p [size:%d], input:%p [size:%d], nbsamples:%d",
-      GST_BUFFER_DATA (outbuf), GST_BUFFER_SIZE (outbuf),
-      GST_BUFFER_DATA (inbuf), GST_BUFFER_SIZE (inbuf), nbsamples);
-
-  ret = audio_resample (resample->res, (short *) GST_BUFFER_DATA (outbuf),
-      (short *) GST_BUFFER_DATA (inbuf), nbsamples);
-
-  GST_DEBUG_OBJECT (resample, "audio_resample returned %d", ret);
-
+  /* start over after a gap, output timestamps are counted from the first
+   * input timestamp after that */
+  if (GST_BUFFER_IS_DISCONT (inbuf) && resample->samples_out > 0)
+    gst_ffmpegaudioresample_reset (resample);
+  if (resample->samples_out == 0 &&
+      !GST_CLOCK_TIME_IS_VALID (resample->timestamp))
+    resample->timestamp = GST_BUFFER_TIMESTAMP (inbuf);
+
+  gst_ffmpegaudioresample_ensure_history (resample, nbsamples);
+  gst_ffmpegaudioresample_deinterleave (resample, GST_BUFFER_DATA (inbuf),
+      nbsamples);
+
+  /* count the output samples for which the whole filter is in the
+   * history */
+  index = resample->index;
+  frac = resample->frac;
+  for (ret = 0; ret < maxsamples &&
+      index + filter->taps <= resample->history_len; ret++)
+    ADVANCE (filter, index, frac);
+
+  GST_DEBUG_OBJECT (resample, "resampling %d samples into %d", nbsamples,
+      ret);
+
+  if (ret > resample->temp_size) {
+    g_free (resample->temp);
+    resample->temp = g_new (gfloat, ret);
+    resample->temp_size = ret;
+  }
+
+  for (c = 0; c < resample->channels; c++) {
+    resample_channel (resample->temp,
+        resample->history + c * resample->history_size, filter,
+        resample->index, resample->frac, ret);
+    gst_ffmpegaudioresample_interleave (resample, GST_BUFFER_DATA (outbuf),
+        resample->temp, c, ret);
+  }
+
+  /* drop the history that no longer contributes */
+  index = MIN (index, resample->history_len);
+  if (index > 0) {
+    resample->history_len -= index;
+    for (c = 0; c < resample->channels; c++) {
+      gfloat *h = resample->history + c * resample->history_size;
+
+      memmove (h, h + index, resample->history_len * sizeof (gfloat));
+    }
+  }
+  resample->index = 0;
+  resample->frac = frac;
+
+  if (GST_CLOCK_TIME_IS_VALID (resample->timestamp)) {
+    GST_BUFFER_TIMESTAMP (outbuf) = resample->timestamp +
+        gst_util_uint64_scale_int (resample->samples_out, GST_SECOND,
+        resample->out_rate);
+  } else {
+    GST_BUFFER_TIMESTAMP (outbuf) = GST_CLOCK_TIME_NONE;
+  }
+  resample->samples_out += ret;
   GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale (ret, GST_SECOND,
       resample->out_rate);
-  GST_BUFFER_SIZE (outbuf) = ret * 2 * resample->out_channels;
+  GST_BUFFER_SIZE (outbuf) = ret * resample->unit_size;
 
   GST_LOG_OBJECT (resample, "Output buffer duration:%" GST_TIME_FORMAT,
       GST_TIME_ARGS (GST_BUFFER_DURATION (outbuf)));
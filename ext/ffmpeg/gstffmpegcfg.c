@@ -28,6 +28,7 @@
 #include "gstffmpeg.h"
 #include "gstffmpegenc.h"
 #include "gstffmpegcfg.h"
+#include "gstffmpegutils.h"
 
 #include <string.h>
 
@@ -371,6 +372,14 @@ static gint mpeg[] = {
   CODEC_ID_NONE
 };
 
+/* codecs whose encoder can split a frame over slice threads */
+static gint threaded[] = {
+  CODEC_ID_MPEG4,
+  CODEC_ID_MPEG1VIDEO,
+  CODEC_ID_MPEG2VIDEO,
+  CODEC_ID_NONE
+};
+
 static gint huffyuv[] = {
   CODEC_ID_HUFFYUV,
   CODEC_ID_FFVHUFF,
@@ -718,6 +727,13 @@ gst_ffmpeg_cfg_init (void)
       "Trellis RD quantization", 0, 1, 1,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
   gst_ffmpeg_add_pspec (pspec, config.trellis, FALSE, mpeg, NULL);
+
+  /* not copied straight, needs avcodec_thread_init () to start the workers */
+  pspec = g_param_spec_int ("threads", "Threads",
+      "Number of threads each frame is encoded with (0 = auto)",
+      0, GST_FFMPEG_MAX_THREADS, 1,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  gst_ffmpeg_add_pspec (pspec, threads, FALSE, threaded, NULL);
 }
 
 /* ==== END CONFIGURATION SECTION ==== */
@@ -43,10 +43,16 @@
 #define TS_MAP_COUNT 0xFF
 #define TS_MAP_INC(ind) ind = (ind + 1) & TS_MAP_COUNT
 
+/* ring of timestamps passed through ffmpeg in reordered_opaque */
+#define OPAQUE_RING_SIZE 0x100
+#define OPAQUE_RING_MASK (OPAQUE_RING_SIZE - 1)
+
 typedef struct _GstDataPassThrough GstDataPassThrough;
 
 struct _GstDataPassThrough
 {
+  /* id passed to ffmpeg, 0 when unused */
+  guint64 id;
   guint64 ts;
   guint64 duration;
   guint64 offset;
@@ -145,6 +151,9 @@ struct _GstFFMpegDec
   gboolean do_padding;
   gboolean debug_mv;
   gboolean crop;
+  gint max_threads;
+  gboolean audio_subbuffers;
+  guint64 max_reverse_bytes;
 
   /* QoS stuff *//* with LOCK */
   gdouble proportion;
@@ -157,13 +166,31 @@ struct _GstFFMpegDec
 
   GstTSHandler ts_handler;
 
-  GList *opaque;
+  /* reordered_opaque values, indexed by id */
+  GstDataPassThrough opaque[OPAQUE_RING_SIZE];
+  guint64 opaque_id;
+  guint opaque_pending;
+  guint opaque_max_pending;
 
   /* reverse playback queue */
   GList *queued;
+  guint64 queued_bytes;
+  /* only keyframes are queued once we hit max_reverse_bytes */
+  gboolean queued_keyframes_only;
 
   /* Can downstream allocate 16bytes aligned data. */
   gboolean can_allocate_aligned;
+
+  /* aligned output buffers for when downstream can't provide them */
+  GstFFMpegBufferPool *pool;
+  /* surfaces from alloc_padded_buffer() that ffmpeg still holds */
+  GSList *padded_surfaces;
+
+  /* audio is decoded in the scratch area and copied into a right-sized
+   * buffer, or decoded in the chunk and pushed as subbuffers of it. */
+  guint8 *audio_scratch;
+  GstBuffer *audio_chunk;
+  guint audio_chunk_offset;
 };
 
 typedef struct _GstFFMpegDecClass GstFFMpegDecClass;
@@ -193,6 +220,12 @@ struct _GstFFMpegDecClass
 #define DEFAULT_DO_PADDING		TRUE
 #define DEFAULT_DEBUG_MV		FALSE
 #define DEFAULT_CROP			TRUE
+#define DEFAULT_MAX_THREADS		0
+#define DEFAULT_AUDIO_SUBBUFFERS	FALSE
+#define DEFAULT_MAX_REVERSE_BYTES	0
+
+/* the audio chunk can hold this many worst case audio frames */
+#define AUDIO_CHUNK_FRAMES 2
 
 enum
 {
@@ -203,6 +236,9 @@ enum
   PROP_DO_PADDING,
   PROP_DEBUG_MV,
   PROP_CROP,
+  PROP_MAX_THREADS,
+  PROP_AUDIO_SUBBUFFERS,
+  PROP_MAX_REVERSE_BYTES,
   PROP_LAST
 };
 
@@ -299,7 +335,7 @@ gst_ffmpegdec_base_init (GstFFMpegDecClass * klass)
   GstPadTemplate *sinktempl, *srctempl;
   GstCaps *sinkcaps, *srccaps;
   AVCodec *in_plugin;
-  gchar *longname, *classification, *description;
+  gchar *longname, *classification, *description, *key;
 
   in_plugin =
       (AVCodec *) g_type_get_qdata (G_OBJECT_CLASS_TYPE (klass),
@@ -321,7 +357,12 @@ gst_ffmpegdec_base_init (GstFFMpegDecClass * klass)
   g_free (description);
 
   /* get the caps */
-  sinkcaps = gst_ffmpeg_codecid_to_caps (in_plugin->id, NULL, FALSE);
+  key = g_strdup_printf ("ffdec-%s-sink", in_plugin->name);
+  if (!gst_ffmpeg_caps_cache_get (key, &sinkcaps)) {
+    sinkcaps = gst_ffmpeg_codecid_to_caps (in_plugin->id, NULL, FALSE);
+    gst_ffmpeg_caps_cache_put (key, sinkcaps);
+  }
+  g_free (key);
   if (!sinkcaps) {
     GST_DEBUG ("Couldn't get sink caps for decoder '%s'", in_plugin->name);
     sinkcaps = gst_caps_from_string ("unknown/unknown");
@@ -329,8 +370,13 @@ gst_ffmpegdec_base_init (GstFFMpegDecClass * klass)
   if (in_plugin->type == CODEC_TYPE_VIDEO) {
     srccaps = gst_caps_from_string ("video/x-raw-rgb; video/x-raw-yuv");
   } else {
-    srccaps = gst_ffmpeg_codectype_to_audio_caps (NULL,
-        in_plugin->id, FALSE, in_plugin);
+    key = g_strdup_printf ("ffdec-%s-src", in_plugin->name);
+    if (!gst_ffmpeg_caps_cache_get (key, &srccaps)) {
+      srccaps = gst_ffmpeg_codectype_to_audio_caps (NULL,
+          in_plugin->id, FALSE, in_plugin);
+      gst_ffmpeg_caps_cache_put (key, srccaps);
+    }
+    g_free (key);
   }
   if (!srccaps) {
     GST_DEBUG ("Couldn't get source caps for decoder '%s'", in_plugin->name);
@@ -391,6 +437,23 @@ gst_ffmpegdec_class_init (GstFFMpegDecClass * klass)
             "Crop images to the display region",
             DEFAULT_CROP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 #endif
+    g_object_class_install_property (gobject_class, PROP_MAX_THREADS,
+        g_param_spec_int ("max-threads", "Maximum decode threads",
+            "Maximum number of worker threads to spawn. (0 = auto)",
+            0, G_MAXINT, DEFAULT_MAX_THREADS,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (gobject_class, PROP_MAX_REVERSE_BYTES,
+        g_param_spec_uint64 ("max-reverse-bytes", "Max reverse bytes",
+            "Maximum amount of decoded data to queue for reverse playback, "
+            "only keyframes are queued beyond this (0 = unlimited)",
+            0, G_MAXUINT64, DEFAULT_MAX_REVERSE_BYTES,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  } else if (klass->in_plugin->type == CODEC_TYPE_AUDIO) {
+    g_object_class_install_property (gobject_class, PROP_AUDIO_SUBBUFFERS,
+        g_param_spec_boolean ("audio-subbuffers", "Audio subbuffers",
+            "Push audio as subbuffers of a bigger chunk instead of copying "
+            "into right-sized buffers", DEFAULT_AUDIO_SUBBUFFERS,
+            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   }
 
   gstelement_class->change_state = gst_ffmpegdec_change_state;
@@ -434,7 +497,10 @@ gst_ffmpegdec_init (GstFFMpegDec * ffmpegdec)
   ffmpegdec->do_padding = DEFAULT_DO_PADDING;
   ffmpegdec->debug_mv = DEFAULT_DEBUG_MV;
   ffmpegdec->crop = DEFAULT_CROP;
-  ffmpegdec->opaque = NULL;
+  ffmpegdec->max_threads = DEFAULT_MAX_THREADS;
+  ffmpegdec->audio_subbuffers = DEFAULT_AUDIO_SUBBUFFERS;
+  ffmpegdec->max_reverse_bytes = DEFAULT_MAX_REVERSE_BYTES;
+  ffmpegdec->opaque_id = 0;
 
   gst_ts_handler_init (ffmpegdec);
 
@@ -445,6 +511,7 @@ gst_ffmpegdec_init (GstFFMpegDec * ffmpegdec)
 
   /* We initially assume downstream can allocate 16 bytes aligned buffers */
   ffmpegdec->can_allocate_aligned = TRUE;
+  ffmpegdec->pool = gst_ffmpeg_buffer_pool_new ();
 }
 
 static void
@@ -462,6 +529,11 @@ gst_ffmpegdec_finalize (GObject * object)
     ffmpegdec->picture = NULL;
   }
 
+  if (ffmpegdec->pool != NULL) {
+    gst_ffmpeg_buffer_pool_free (ffmpegdec->pool);
+    ffmpegdec->pool = NULL;
+  }
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -583,6 +655,10 @@ gst_ffmpegdec_close (GstFFMpegDec * ffmpegdec)
     gst_ffmpeg_avcodec_close (ffmpegdec->context);
   ffmpegdec->opened = FALSE;
 
+  /* closing released all surfaces, this is just in case */
+  g_slist_free (ffmpegdec->padded_surfaces);
+  ffmpegdec->padded_surfaces = NULL;
+
   if (ffmpegdec->context->palctrl) {
     av_free (ffmpegdec->context->palctrl);
     ffmpegdec->context->palctrl = NULL;
@@ -694,6 +770,10 @@ gst_ffmpegdec_open (GstFFMpegDec * ffmpegdec)
 could_not_open:
   {
     gst_ffmpegdec_close (ffmpegdec);
+    /* the worker pool is normally released by avcodec_close(), which is never
+     * called when the codec failed to open */
+    if (ffmpegdec->context->thread_opaque)
+      avcodec_thread_free (ffmpegdec->context);
     GST_DEBUG_OBJECT (ffmpegdec, "ffdec_%s: Failed to open FFMPEG codec",
         oclass->in_plugin->name);
     return FALSE;
@@ -846,6 +926,33 @@ gst_ffmpegdec_setcaps (GstPad * pad, GstCaps * caps)
    * supports it) */
   ffmpegdec->context->debug_mv = ffmpegdec->debug_mv;
 
+  /* spawn the libavcodec worker pool. The bundled libavcodec only does slice
+   * threading through execute(), so get_buffer/release_buffer and the opaque
+   * timestamp bookkeeping keep being called from the streaming thread only */
+  if (oclass->in_plugin->type == CODEC_TYPE_VIDEO) {
+    gint n_threads;
+
+    if (ffmpegdec->max_threads == 0)
+      n_threads = gst_ffmpeg_auto_max_threads ();
+    else
+      n_threads = ffmpegdec->max_threads;
+
+    /* MPV_common_init() refuses to open with more threads than MAX_THREADS
+     * or than there are macroblock rows, and we only know the latter when
+     * the caps carry a size */
+    n_threads = MIN (n_threads, GST_FFMPEG_MAX_THREADS);
+    if (ffmpegdec->context->height > 0)
+      n_threads = MIN (n_threads, (ffmpegdec->context->height + 15) / 16);
+    else if (ffmpegdec->max_threads == 0)
+      n_threads = 1;
+
+    GST_DEBUG_OBJECT (ffmpegdec, "using %d decoding threads", n_threads);
+    if (avcodec_thread_init (ffmpegdec->context, n_threads) < 0) {
+      GST_WARNING_OBJECT (ffmpegdec, "failed to start decoding threads");
+      ffmpegdec->context->thread_count = 1;
+    }
+  }
+
   /* open codec - we don't select an output pix_fmt yet,
    * simply because we don't know! We only get it
    * during playback... */
@@ -926,7 +1033,8 @@ alloc_output_buffer (GstFFMpegDec * ffmpegdec, GstBuffer ** outbuf,
           "Downstream can't allocate aligned buffers.");
       ffmpegdec->can_allocate_aligned = FALSE;
       gst_buffer_unref (*outbuf);
-      *outbuf = new_aligned_buffer (fsize, GST_PAD_CAPS (ffmpegdec->srcpad));
+      *outbuf = gst_ffmpeg_buffer_pool_get (ffmpegdec->pool, fsize,
+          GST_PAD_CAPS (ffmpegdec->srcpad));
     }
   } else {
     GST_LOG_OBJECT (ffmpegdec,
@@ -935,7 +1043,8 @@ alloc_output_buffer (GstFFMpegDec * ffmpegdec, GstBuffer ** outbuf,
      * fsize contains the size of the palette, so the overall size
      * is bigger than ffmpegcolorspace's unit size, which will
      * prompt GstBaseTransform to complain endlessly ... */
-    *outbuf = new_aligned_buffer (fsize, GST_PAD_CAPS (ffmpegdec->srcpad));
+    *outbuf = gst_ffmpeg_buffer_pool_get (ffmpegdec->pool, fsize,
+        GST_PAD_CAPS (ffmpegdec->srcpad));
     ret = GST_FLOW_OK;
   }
   return ret;
@@ -954,6 +1063,31 @@ alloc_failed:
   }
 }
 
+/* alloc a surface for ffmpeg to decode into that is bigger than the clipped
+ * output, we push a subbuffer of it later */
+static GstFlowReturn
+alloc_padded_buffer (GstFFMpegDec * ffmpegdec, GstBuffer ** outbuf,
+    gint width, gint height)
+{
+  gint fsize;
+
+  *outbuf = NULL;
+
+  if (G_UNLIKELY (!gst_ffmpegdec_negotiate (ffmpegdec, FALSE))) {
+    GST_DEBUG_OBJECT (ffmpegdec, "negotiate failed");
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  fsize = gst_ffmpeg_avpicture_get_size (ffmpegdec->context->pix_fmt,
+      width, height);
+
+  /* downstream can't alloc buffers bigger than the caps, use our pool */
+  *outbuf = gst_ffmpeg_buffer_pool_get (ffmpegdec->pool, fsize,
+      GST_PAD_CAPS (ffmpegdec->srcpad));
+
+  return GST_FLOW_OK;
+}
+
 static int
 gst_ffmpegdec_get_buffer (AVCodecContext * context, AVFrame * picture)
 {
@@ -1019,13 +1153,24 @@ gst_ffmpegdec_get_buffer (AVCodecContext * context, AVFrame * picture)
           width, height, clip_width, clip_height);
 
       if (width != clip_width || height != clip_height) {
-        /* We can't alloc if we need to clip the output buffer later */
-        GST_LOG_OBJECT (ffmpegdec, "we need clipping, fallback alloc");
-        return avcodec_default_get_buffer (context, picture);
+        /* For packed formats with only extra rows, the clipped picture is the
+         * start of the padded one. We decode into a padded surface and push
+         * a subbuffer of it. For planar formats, the padding of one plane
+         * overlaps the next plane of the clipped layout so we need to copy. */
+        if (width != clip_width || context->palctrl ||
+            !gst_ffmpeg_avpicture_is_packed (context->pix_fmt)) {
+          GST_LOG_OBJECT (ffmpegdec, "we need clipping, fallback alloc");
+          return avcodec_default_get_buffer (context, picture);
+        }
+        GST_LOG_OBJECT (ffmpegdec, "clipping rows, alloc padded surface");
+        ret = alloc_padded_buffer (ffmpegdec, &buf, width, height);
+        if (ret == GST_FLOW_OK)
+          ffmpegdec->padded_surfaces =
+              g_slist_prepend (ffmpegdec->padded_surfaces, buf);
+      } else {
+        /* alloc with aligned dimensions for ffmpeg */
+        ret = alloc_output_buffer (ffmpegdec, &buf, width, height);
       }
-
-      /* alloc with aligned dimensions for ffmpeg */
-      ret = alloc_output_buffer (ffmpegdec, &buf, width, height);
       if (G_UNLIKELY (ret != GST_FLOW_OK)) {
         /* alloc default buffer when we can't get one from downstream */
         GST_LOG_OBJECT (ffmpegdec, "alloc failed, fallback alloc");
@@ -1083,6 +1228,8 @@ gst_ffmpegdec_release_buffer (AVCodecContext * context, AVFrame * picture)
   buf = GST_BUFFER_CAST (picture->opaque);
   GST_DEBUG_OBJECT (ffmpegdec, "release buffer %p", buf);
   picture->opaque = NULL;
+  ffmpegdec->padded_surfaces =
+      g_slist_remove (ffmpegdec->padded_surfaces, buf);
 
 #ifdef EXTRA_REF
   if (picture->reference != 0 || ffmpegdec->extra_ref) {
@@ -1510,16 +1657,37 @@ check_keyframe (GstFFMpegDec * ffmpegdec)
   return iskeyframe;
 }
 
+/* the size of the output picture, this is the clipping region but only when
+ * it is smaller than the actual picture size. */
+static void
+get_clip_size (GstFFMpegDec * ffmpegdec, gint * width, gint * height)
+{
+  if ((*width = ffmpegdec->format.video.clip_width) == -1)
+    *width = ffmpegdec->context->width;
+  else if (*width > ffmpegdec->context->width)
+    *width = ffmpegdec->context->width;
+
+  if ((*height = ffmpegdec->format.video.clip_height) == -1)
+    *height = ffmpegdec->context->height;
+  else if (*height > ffmpegdec->context->height)
+    *height = ffmpegdec->context->height;
+
+  GST_LOG_OBJECT (ffmpegdec, "clip width %d/height %d", *width, *height);
+}
+
 /* get an outbuf buffer with the current picture */
 static GstFlowReturn
 get_output_buffer (GstFFMpegDec * ffmpegdec, GstBuffer ** outbuf)
 {
   GstFlowReturn ret;
+  gint width, height;
 
   ret = GST_FLOW_OK;
   *outbuf = NULL;
 
   if (ffmpegdec->picture->opaque != NULL) {
+    gint fsize;
+
     /* we allocated a picture already for ffmpeg to decode into, let's pick it
      * up and use it now. */
     *outbuf = (GstBuffer *) ffmpegdec->picture->opaque;
@@ -1527,26 +1695,30 @@ get_output_buffer (GstFFMpegDec * ffmpegdec, GstBuffer ** outbuf)
 #ifndef EXTRA_REF
     gst_buffer_ref (*outbuf);
 #endif
+
+    get_clip_size (ffmpegdec, &width, &height);
+    fsize = gst_ffmpeg_avpicture_get_size (ffmpegdec->context->pix_fmt,
+        width, height);
+
+    /* we decoded into a padded surface, push the clipped part of it */
+    if (G_UNLIKELY (g_slist_find (ffmpegdec->padded_surfaces, *outbuf) &&
+            fsize > 0 && GST_BUFFER_SIZE (*outbuf) > fsize)) {
+      GstBuffer *sub;
+
+      GST_LOG_OBJECT (ffmpegdec, "clipping padded surface to %d bytes", fsize);
+      sub = gst_buffer_create_sub (*outbuf, 0, fsize);
+      gst_buffer_set_caps (sub, GST_PAD_CAPS (ffmpegdec->srcpad));
+      gst_buffer_unref (*outbuf);
+      *outbuf = sub;
+    }
   } else {
     AVPicture pic, *outpic;
-    gint width, height;
 
     GST_LOG_OBJECT (ffmpegdec, "get output buffer");
 
     /* figure out size of output buffer, this is the clipped output size because
-     * we will copy the picture into it but only when the clipping region is
-     * smaller than the actual picture size. */
-    if ((width = ffmpegdec->format.video.clip_width) == -1)
-      width = ffmpegdec->context->width;
-    else if (width > ffmpegdec->context->width)
-      width = ffmpegdec->context->width;
-
-    if ((height = ffmpegdec->format.video.clip_height) == -1)
-      height = ffmpegdec->context->height;
-    else if (height > ffmpegdec->context->height)
-      height = ffmpegdec->context->height;
-
-    GST_LOG_OBJECT (ffmpegdec, "clip width %d/height %d", width, height);
+     * we will copy the picture into it */
+    get_clip_size (ffmpegdec, &width, &height);
 
     ret = alloc_output_buffer (ffmpegdec, outbuf, width, height);
     if (G_UNLIKELY (ret != GST_FLOW_OK))
@@ -1585,6 +1757,8 @@ clear_queued (GstFFMpegDec * ffmpegdec)
   g_list_foreach (ffmpegdec->queued, (GFunc) gst_mini_object_unref, NULL);
   g_list_free (ffmpegdec->queued);
   ffmpegdec->queued = NULL;
+  ffmpegdec->queued_bytes = 0;
+  ffmpegdec->queued_keyframes_only = FALSE;
 }
 
 static GstFlowReturn
@@ -1608,67 +1782,112 @@ flush_queued (GstFFMpegDec * ffmpegdec)
     ffmpegdec->queued =
         g_list_delete_link (ffmpegdec->queued, ffmpegdec->queued);
   }
+  ffmpegdec->queued_bytes = 0;
+  ffmpegdec->queued_keyframes_only = FALSE;
+
   return res;
 }
 
-static gpointer
+/* queue a frame for reverse playback. When we hit the limit, drop the
+ * remaining non-keyframes until the queue is flushed at the next discont. */
+static void
+queue_reverse (GstFFMpegDec * ffmpegdec, GstBuffer * buf)
+{
+  gboolean keyframe;
+
+  keyframe = !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  if (ffmpegdec->max_reverse_bytes > 0 && !ffmpegdec->queued_keyframes_only &&
+      ffmpegdec->queued_bytes + GST_BUFFER_SIZE (buf) >
+      ffmpegdec->max_reverse_bytes) {
+    GST_DEBUG_OBJECT (ffmpegdec, "queued %" G_GUINT64_FORMAT
+        " bytes, only queueing keyframes now", ffmpegdec->queued_bytes);
+    ffmpegdec->queued_keyframes_only = TRUE;
+  }
+
+  if (ffmpegdec->queued_keyframes_only && !keyframe) {
+    GST_DEBUG_OBJECT (ffmpegdec, "dropping non-keyframe");
+    gst_buffer_unref (buf);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (ffmpegdec, "queued frame");
+  ffmpegdec->queued = g_list_prepend (ffmpegdec->queued, buf);
+  ffmpegdec->queued_bytes += GST_BUFFER_SIZE (buf);
+}
+
+static guint64
 opaque_store (GstFFMpegDec * ffmpegdec, guint64 ts, guint64 duration,
     guint64 offset)
 {
-  GstDataPassThrough *opaque = g_slice_new0 (GstDataPassThrough);
+  GstDataPassThrough *opaque;
+  guint64 id;
+
+  /* ids are never 0 */
+  id = ++ffmpegdec->opaque_id;
+  opaque = &ffmpegdec->opaque[id & OPAQUE_RING_MASK];
+
+  if (opaque->id != 0) {
+    /* ffmpeg never gave this one back, it probably dropped the frame */
+    GST_DEBUG_OBJECT (ffmpegdec, "overwriting stale opaque %" G_GUINT64_FORMAT,
+        opaque->id);
+  } else if (++ffmpegdec->opaque_pending > ffmpegdec->opaque_max_pending) {
+    ffmpegdec->opaque_max_pending = ffmpegdec->opaque_pending;
+    GST_LOG_OBJECT (ffmpegdec, "opaque high-water mark now %u",
+        ffmpegdec->opaque_max_pending);
+  }
+
+  opaque->id = id;
   opaque->ts = ts;
   opaque->duration = duration;
   opaque->offset = offset;
-  ffmpegdec->opaque = g_list_append (ffmpegdec->opaque, (gpointer) opaque);
   GST_DEBUG_OBJECT (ffmpegdec,
       "Stored ts:%" GST_TIME_FORMAT ", duration:%" GST_TIME_FORMAT ", offset:%"
-      G_GUINT64_FORMAT " as opaque %p", GST_TIME_ARGS (ts),
-      GST_TIME_ARGS (duration), offset, (gpointer) opaque);
-  return opaque;
+      G_GUINT64_FORMAT " as opaque %" G_GUINT64_FORMAT, GST_TIME_ARGS (ts),
+      GST_TIME_ARGS (duration), offset, id);
+  return id;
 }
 
 static gboolean
-opaque_find (GstFFMpegDec * ffmpegdec, gpointer opaque_val, guint64 * _ts,
+opaque_find (GstFFMpegDec * ffmpegdec, guint64 id, guint64 * _ts,
     guint64 * _duration, gint64 * _offset)
 {
-  GstClockTime ts = GST_CLOCK_TIME_NONE;
-  GstClockTime duration = GST_CLOCK_TIME_NONE;
-  gint64 offset = GST_BUFFER_OFFSET_NONE;
-  GList *i;
-
-  for (i = ffmpegdec->opaque; i != NULL; i = g_list_next (i)) {
-    if (i->data == (gpointer) opaque_val) {
-      ts = ((GstDataPassThrough *) i->data)->ts;
-      duration = ((GstDataPassThrough *) i->data)->duration;
-      offset = ((GstDataPassThrough *) i->data)->offset;
-      GST_DEBUG_OBJECT (ffmpegdec,
-          "Found opaque %p - ts:%" GST_TIME_FORMAT ", duration:%"
-          GST_TIME_FORMAT ", offset:%" G_GINT64_FORMAT, i->data,
-          GST_TIME_ARGS (ts), GST_TIME_ARGS (duration), offset);
-      if (_ts)
-        *_ts = ts;
-      if (_duration)
-        *_duration = duration;
-      if (_offset)
-        *_offset = offset;
-      g_slice_free (GstDataPassThrough, i->data);
-      ffmpegdec->opaque = g_list_delete_link (ffmpegdec->opaque, i);
-      return TRUE;
-    }
-  }
-  return FALSE;
+  GstDataPassThrough *opaque;
+
+  opaque = &ffmpegdec->opaque[id & OPAQUE_RING_MASK];
+  if (id == 0 || opaque->id != id)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (ffmpegdec,
+      "Found opaque %" G_GUINT64_FORMAT " - ts:%" GST_TIME_FORMAT
+      ", duration:%" GST_TIME_FORMAT ", offset:%" G_GINT64_FORMAT, id,
+      GST_TIME_ARGS (opaque->ts), GST_TIME_ARGS (opaque->duration),
+      (gint64) opaque->offset);
+  if (_ts)
+    *_ts = opaque->ts;
+  if (_duration)
+    *_duration = opaque->duration;
+  if (_offset)
+    *_offset = opaque->offset;
+
+  opaque->id = 0;
+  ffmpegdec->opaque_pending--;
+
+  return TRUE;
 }
 
 static void
 flush_opaque (GstFFMpegDec * ffmpegdec)
 {
-  GList *tmp;
+  guint i;
 
-  for (tmp = ffmpegdec->opaque; tmp; tmp = tmp->next)
-    g_slice_free (GstDataPassThrough, tmp->data);
-  if (ffmpegdec->opaque)
-    g_list_free (ffmpegdec->opaque);
-  ffmpegdec->opaque = NULL;
+  GST_DEBUG_OBJECT (ffmpegdec, "opaque high-water mark was %u",
+      ffmpegdec->opaque_max_pending);
+
+  for (i = 0; i < OPAQUE_RING_SIZE; i++)
+    ffmpegdec->opaque[i].id = 0;
+  ffmpegdec->opaque_pending = 0;
+  ffmpegdec->opaque_max_pending = 0;
 }
 
 /* gst_ffmpegdec_[video|audio]_frame:
@@ -1741,14 +1960,10 @@ gst_ffmpegdec_video_frame (GstFFMpegDec * ffmpegdec,
       G_GINT64_FORMAT, GST_TIME_ARGS (in_timestamp), in_offset);
 
   out_timestamp = gst_ts_handler_get_ts (ffmpegdec, &out_offset, &out_duration);
-  /* Never do this at home...
-   * 1) We know that ffmpegdec->context->reordered_opaque is 64-bit, and thus
-   * is capable of holding virtually anything including pointers
-   * (unless we're on 128-bit platform...)
-   */
+  /* ffmpeg passes reordered_opaque along with the frame, we use it to look up
+   * the timestamps again when the frame comes out. */
   ffmpegdec->context->reordered_opaque = (gint64)
-      GPOINTER_TO_SIZE (opaque_store (ffmpegdec, out_timestamp, out_duration,
-          out_offset));
+      opaque_store (ffmpegdec, out_timestamp, out_duration, out_offset);
 
   /* now decode the frame */
   len = avcodec_decode_video (ffmpegdec->context,
@@ -1782,10 +1997,10 @@ gst_ffmpegdec_video_frame (GstFFMpegDec * ffmpegdec,
 
   /* recuperate the reordered timestamp */
   if (!opaque_find (ffmpegdec,
-          (gpointer) (gulong) ffmpegdec->picture->reordered_opaque, &out_pts,
+          (guint64) ffmpegdec->picture->reordered_opaque, &out_pts,
           &out_duration, &out_offset)) {
-    GST_DEBUG_OBJECT (ffmpegdec, "Failed to find opaque %p",
-        (gpointer) (gulong) ffmpegdec->picture->reordered_opaque);
+    GST_DEBUG_OBJECT (ffmpegdec, "Failed to find opaque %" G_GINT64_FORMAT,
+        ffmpegdec->picture->reordered_opaque);
     out_pts = -1;
     out_duration = -1;
     out_offset = GST_BUFFER_OFFSET_NONE;
@@ -2087,6 +2302,31 @@ out_of_segment:
   }
 }
 
+/* make sure the audio chunk has room for a worst case audio frame */
+static void
+setup_audio_chunk (GstFFMpegDec * ffmpegdec)
+{
+  if (ffmpegdec->audio_chunk != NULL) {
+    if (GST_MINI_OBJECT_REFCOUNT_VALUE (ffmpegdec->audio_chunk) == 1) {
+      /* no subbuffers alive anymore, start over at the beginning */
+      ffmpegdec->audio_chunk_offset = 0;
+    } else if (GST_BUFFER_SIZE (ffmpegdec->audio_chunk) -
+        ffmpegdec->audio_chunk_offset < AVCODEC_MAX_AUDIO_FRAME_SIZE) {
+      /* full, the last subbuffer going away will free it */
+      GST_LOG_OBJECT (ffmpegdec, "audio chunk full, allocating a new one");
+      gst_buffer_unref (ffmpegdec->audio_chunk);
+      ffmpegdec->audio_chunk = NULL;
+    }
+  }
+
+  if (ffmpegdec->audio_chunk == NULL) {
+    ffmpegdec->audio_chunk =
+        new_aligned_buffer (AVCODEC_MAX_AUDIO_FRAME_SIZE * AUDIO_CHUNK_FRAMES,
+        NULL);
+    ffmpegdec->audio_chunk_offset = 0;
+  }
+}
+
 static gint
 gst_ffmpegdec_audio_frame (GstFFMpegDec * ffmpegdec,
     AVCodec * in_plugin, guint8 * data, guint size,
@@ -2095,6 +2335,7 @@ gst_ffmpegdec_audio_frame (GstFFMpegDec * ffmpegdec,
 {
   gint len = -1;
   gint have_data = AVCODEC_MAX_AUDIO_FRAME_SIZE;
+  guint8 *samples;
 
   GST_DEBUG_OBJECT (ffmpegdec,
       "size:%d, offset:%" G_GINT64_FORMAT ", ts:%" GST_TIME_FORMAT ", dur:%"
@@ -2102,26 +2343,47 @@ gst_ffmpegdec_audio_frame (GstFFMpegDec * ffmpegdec,
       in_offset, GST_TIME_ARGS (in_timestamp), GST_TIME_ARGS (in_duration),
       GST_TIME_ARGS (ffmpegdec->next_ts));
 
-  *outbuf =
-      new_aligned_buffer (AVCODEC_MAX_AUDIO_FRAME_SIZE,
-      GST_PAD_CAPS (ffmpegdec->srcpad));
+  *outbuf = NULL;
+
+  if (ffmpegdec->audio_subbuffers) {
+    setup_audio_chunk (ffmpegdec);
+    samples = GST_BUFFER_DATA (ffmpegdec->audio_chunk) +
+        ffmpegdec->audio_chunk_offset;
+  } else {
+    if (ffmpegdec->audio_scratch == NULL)
+      ffmpegdec->audio_scratch = av_malloc (AVCODEC_MAX_AUDIO_FRAME_SIZE);
+    samples = ffmpegdec->audio_scratch;
+  }
 
   len = avcodec_decode_audio2 (ffmpegdec->context,
-      (int16_t *) GST_BUFFER_DATA (*outbuf), &have_data, data, size);
+      (int16_t *) samples, &have_data, data, size);
   GST_DEBUG_OBJECT (ffmpegdec,
       "Decode audio: len=%d, have_data=%d", len, have_data);
 
   if (len >= 0 && have_data > 0) {
     GST_DEBUG_OBJECT (ffmpegdec, "Creating output buffer");
     if (!gst_ffmpegdec_negotiate (ffmpegdec, FALSE)) {
-      gst_buffer_unref (*outbuf);
-      *outbuf = NULL;
       len = -1;
       goto beach;
     }
 
-    /* Buffer size */
-    GST_BUFFER_SIZE (*outbuf) = have_data;
+    if (ffmpegdec->audio_subbuffers) {
+      *outbuf = gst_buffer_create_sub (ffmpegdec->audio_chunk,
+          ffmpegdec->audio_chunk_offset, have_data);
+      gst_buffer_set_caps (*outbuf, GST_PAD_CAPS (ffmpegdec->srcpad));
+      /* keep the next frame aligned */
+      ffmpegdec->audio_chunk_offset =
+          MIN (GST_ROUND_UP_16 (ffmpegdec->audio_chunk_offset + have_data),
+          GST_BUFFER_SIZE (ffmpegdec->audio_chunk));
+    } else {
+      *ret = gst_pad_alloc_buffer_and_set_caps (ffmpegdec->srcpad,
+          GST_BUFFER_OFFSET_NONE, have_data,
+          GST_PAD_CAPS (ffmpegdec->srcpad), outbuf);
+      if (G_UNLIKELY (*ret != GST_FLOW_OK))
+        goto alloc_failed;
+
+      memcpy (GST_BUFFER_DATA (*outbuf), samples, have_data);
+    }
 
     /*
      * Timestamps:
@@ -2159,10 +2421,6 @@ gst_ffmpegdec_audio_frame (GstFFMpegDec * ffmpegdec,
     if (G_UNLIKELY (!clip_audio_buffer (ffmpegdec, *outbuf, in_timestamp,
                 in_duration)))
       goto clipped;
-
-  } else {
-    gst_buffer_unref (*outbuf);
-    *outbuf = NULL;
   }
 
   /* If we don't error out after the first failed read with the AAC decoder,
@@ -2186,6 +2444,13 @@ clipped:
     *outbuf = NULL;
     goto beach;
   }
+alloc_failed:
+  {
+    GST_DEBUG_OBJECT (ffmpegdec, "pad_alloc failed %d (%s)", *ret,
+        gst_flow_get_name (*ret));
+    *outbuf = NULL;
+    goto beach;
+  }
 }
 
 /* gst_ffmpegdec_frame:
@@ -2289,8 +2554,7 @@ gst_ffmpegdec_frame (GstFFMpegDec * ffmpegdec,
       *ret = gst_pad_push (ffmpegdec->srcpad, outbuf);
     } else {
       /* reverse playback, queue frame till later when we get a discont. */
-      GST_DEBUG_OBJECT (ffmpegdec, "queued frame");
-      ffmpegdec->queued = g_list_prepend (ffmpegdec->queued, outbuf);
+      queue_reverse (ffmpegdec, outbuf);
       *ret = GST_FLOW_OK;
     }
   } else {
@@ -2479,100 +2743,47 @@ invalid_format:
   }
 }
 
-static GstFlowReturn
-gst_ffmpegdec_chain (GstPad * pad, GstBuffer * inbuf)
+/* join the parse cache with new data in a buffer that has the padding ffmpeg
+ * needs, so that we don't need to copy it again before decoding. */
+static GstBuffer *
+join_padded (GstBuffer * head, GstBuffer * tail)
 {
-  GstFFMpegDec *ffmpegdec;
-  GstFFMpegDecClass *oclass;
-  guint8 *data, *bdata, *pdata;
-  gint size, bsize, len, have_data;
-  GstFlowReturn ret = GST_FLOW_OK;
-  GstClockTime in_timestamp, in_duration;
-  gboolean discont;
-  gint64 in_offset;
-
-  ffmpegdec = (GstFFMpegDec *) (GST_PAD_PARENT (pad));
-
-  if (G_UNLIKELY (!ffmpegdec->opened))
-    goto not_negotiated;
-
-  discont = GST_BUFFER_IS_DISCONT (inbuf);
-
-  /* The discont flags marks a buffer that is not continuous with the previous
-   * buffer. This means we need to clear whatever data we currently have. We
-   * currently also wait for a new keyframe, which might be suboptimal in the
-   * case of a network error, better show the errors than to drop all data.. */
-  if (G_UNLIKELY (discont)) {
-    GST_DEBUG_OBJECT (ffmpegdec, "received DISCONT");
-    /* drain what we have queued */
-    gst_ffmpegdec_drain (ffmpegdec);
-    gst_ffmpegdec_flush_pcache (ffmpegdec);
-    avcodec_flush_buffers (ffmpegdec->context);
-    ffmpegdec->discont = TRUE;
-    ffmpegdec->last_out = GST_CLOCK_TIME_NONE;
-    ffmpegdec->next_ts = GST_CLOCK_TIME_NONE;
-  }
-  /* by default we clear the input timestamp after decoding each frame so that
-   * interpollation can work. */
-  ffmpegdec->clear_ts = TRUE;
-
-  oclass = (GstFFMpegDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
-
-  /* do early keyframe check pretty bad to rely on the keyframe flag in the
-   * source for this as it might not even be parsed (UDP/file/..).  */
-  if (G_UNLIKELY (ffmpegdec->waiting_for_key)) {
-    GST_DEBUG_OBJECT (ffmpegdec, "waiting for keyframe");
-    if (GST_BUFFER_FLAG_IS_SET (inbuf, GST_BUFFER_FLAG_DELTA_UNIT) &&
-        oclass->in_plugin->type != CODEC_TYPE_AUDIO)
-      goto skip_keyframe;
-
-    GST_DEBUG_OBJECT (ffmpegdec, "got keyframe");
-    ffmpegdec->waiting_for_key = FALSE;
-  }
-
-  /* append the unaltered buffer timestamp to list */
-  gst_ts_handler_append (ffmpegdec, inbuf);
-
-  in_timestamp = GST_BUFFER_TIMESTAMP (inbuf);
-  in_duration = GST_BUFFER_DURATION (inbuf);
-  in_offset = GST_BUFFER_OFFSET (inbuf);
+  GstBuffer *buf;
+  guint hsize, size;
 
-  GST_LOG_OBJECT (ffmpegdec,
-      "Received new data of size %u, offset:%" G_GUINT64_FORMAT ", ts:%"
-      GST_TIME_FORMAT ", dur:%" GST_TIME_FORMAT,
-      GST_BUFFER_SIZE (inbuf), GST_BUFFER_OFFSET (inbuf),
-      GST_TIME_ARGS (in_timestamp), GST_TIME_ARGS (in_duration));
+  hsize = GST_BUFFER_SIZE (head);
+  size = hsize + GST_BUFFER_SIZE (tail);
 
-  /* parse cache joining. If there is cached data, its timestamp will be what we
-   * send to the parse. */
-  if (ffmpegdec->pcache) {
-    /* use timestamp and duration of what is in the cache */
-    in_timestamp = GST_BUFFER_TIMESTAMP (ffmpegdec->pcache);
-    in_duration = GST_BUFFER_DURATION (ffmpegdec->pcache);
-    in_offset = GST_BUFFER_OFFSET (ffmpegdec->pcache);
+  buf = gst_buffer_new_and_alloc (size + FF_INPUT_BUFFER_PADDING_SIZE);
+  memcpy (GST_BUFFER_DATA (buf), GST_BUFFER_DATA (head), hsize);
+  memcpy (GST_BUFFER_DATA (buf) + hsize, GST_BUFFER_DATA (tail),
+      GST_BUFFER_SIZE (tail));
+  memset (GST_BUFFER_DATA (buf) + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+  GST_BUFFER_SIZE (buf) = size;
 
-    /* join with previous data */
-    inbuf = gst_buffer_join (ffmpegdec->pcache, inbuf);
+  gst_buffer_copy_metadata (buf, head, GST_BUFFER_COPY_TIMESTAMPS);
 
-    GST_LOG_OBJECT (ffmpegdec,
-        "joined parse cache, inbuf now has offset %" G_GINT64_FORMAT ", ts:%"
-        GST_TIME_FORMAT, in_offset, GST_TIME_ARGS (in_timestamp));
+  gst_buffer_unref (head);
+  gst_buffer_unref (tail);
 
-    /* no more cached data, we assume we can consume the complete cache */
-    ffmpegdec->pcache = NULL;
-  }
+  return buf;
+}
 
-  /* workarounds, functions write to buffers:
-   *  libavcodec/svq1.c:svq1_decode_frame writes to the given buffer.
-   *  libavcodec/svq3.c:svq3_decode_slice_header too.
-   * ffmpeg devs know about it and will fix it (they said). */
-  if (oclass->in_plugin->id == CODEC_ID_SVQ1 ||
-      oclass->in_plugin->id == CODEC_ID_SVQ3) {
-    inbuf = gst_buffer_make_writable (inbuf);
-  }
+/* parse and decode the data in inbuf, the parser left-over is kept in the
+ * parse cache. When padded is set, inbuf is known to be followed by zeroed
+ * padding and is decoded in place. Takes ownership of inbuf. */
+static GstFlowReturn
+gst_ffmpegdec_decode_buffer (GstFFMpegDec * ffmpegdec, GstBuffer * inbuf,
+    gboolean padded, GstClockTime in_timestamp, GstClockTime in_duration,
+    gint64 in_offset)
+{
+  guint8 *data, *bdata, *pdata, *bend;
+  gint size, bsize, len, have_data;
+  GstFlowReturn ret = GST_FLOW_OK;
 
   bdata = GST_BUFFER_DATA (inbuf);
   bsize = GST_BUFFER_SIZE (inbuf);
+  bend = bdata + bsize;
 
   do {
     /* parse, if at all possible */
@@ -2624,7 +2835,8 @@ gst_ffmpegdec_chain (GstPad * pad, GstBuffer * inbuf)
       ffmpegdec->in_offset = in_offset;
     }
 
-    if (ffmpegdec->do_padding) {
+    if (ffmpegdec->do_padding && !(padded && data >= GST_BUFFER_DATA (inbuf)
+            && data + size <= bend)) {
       /* add padding */
       if (ffmpegdec->padded_size < size + FF_INPUT_BUFFER_PADDING_SIZE) {
         ffmpegdec->padded_size = size + FF_INPUT_BUFFER_PADDING_SIZE;
@@ -2719,6 +2931,123 @@ gst_ffmpegdec_chain (GstPad * pad, GstBuffer * inbuf)
   gst_buffer_unref (inbuf);
 
   return ret;
+}
+
+static GstFlowReturn
+gst_ffmpegdec_chain (GstPad * pad, GstBuffer * inbuf)
+{
+  GstFFMpegDec *ffmpegdec;
+  GstFFMpegDecClass *oclass;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *joined = NULL;
+  GstClockTime in_timestamp, in_duration;
+  gboolean discont;
+  gint64 in_offset;
+
+  ffmpegdec = (GstFFMpegDec *) (GST_PAD_PARENT (pad));
+
+  if (G_UNLIKELY (!ffmpegdec->opened))
+    goto not_negotiated;
+
+  discont = GST_BUFFER_IS_DISCONT (inbuf);
+
+  /* The discont flags marks a buffer that is not continuous with the previous
+   * buffer. This means we need to clear whatever data we currently have. We
+   * currently also wait for a new keyframe, which might be suboptimal in the
+   * case of a network error, better show the errors than to drop all data.. */
+  if (G_UNLIKELY (discont)) {
+    GST_DEBUG_OBJECT (ffmpegdec, "received DISCONT");
+    /* drain what we have queued */
+    gst_ffmpegdec_drain (ffmpegdec);
+    gst_ffmpegdec_flush_pcache (ffmpegdec);
+    avcodec_flush_buffers (ffmpegdec->context);
+    ffmpegdec->discont = TRUE;
+    ffmpegdec->last_out = GST_CLOCK_TIME_NONE;
+    ffmpegdec->next_ts = GST_CLOCK_TIME_NONE;
+  }
+  /* by default we clear the input timestamp after decoding each frame so that
+   * interpollation can work. */
+  ffmpegdec->clear_ts = TRUE;
+
+  oclass = (GstFFMpegDecClass *) (G_OBJECT_GET_CLASS (ffmpegdec));
+
+  /* do early keyframe check pretty bad to rely on the keyframe flag in the
+   * source for this as it might not even be parsed (UDP/file/..).  */
+  if (G_UNLIKELY (ffmpegdec->waiting_for_key)) {
+    GST_DEBUG_OBJECT (ffmpegdec, "waiting for keyframe");
+    if (GST_BUFFER_FLAG_IS_SET (inbuf, GST_BUFFER_FLAG_DELTA_UNIT) &&
+        oclass->in_plugin->type != CODEC_TYPE_AUDIO)
+      goto skip_keyframe;
+
+    GST_DEBUG_OBJECT (ffmpegdec, "got keyframe");
+    ffmpegdec->waiting_for_key = FALSE;
+  }
+
+  /* append the unaltered buffer timestamp to list */
+  gst_ts_handler_append (ffmpegdec, inbuf);
+
+  in_timestamp = GST_BUFFER_TIMESTAMP (inbuf);
+  in_duration = GST_BUFFER_DURATION (inbuf);
+  in_offset = GST_BUFFER_OFFSET (inbuf);
+
+  GST_LOG_OBJECT (ffmpegdec,
+      "Received new data of size %u, offset:%" G_GUINT64_FORMAT ", ts:%"
+      GST_TIME_FORMAT ", dur:%" GST_TIME_FORMAT,
+      GST_BUFFER_SIZE (inbuf), GST_BUFFER_OFFSET (inbuf),
+      GST_TIME_ARGS (in_timestamp), GST_TIME_ARGS (in_duration));
+
+  /* parse cache. The parser keeps partial frames itself, so we feed it the
+   * cached data first instead of copying it together with the new data. */
+  if (ffmpegdec->pcache) {
+    GstBuffer *pcache = ffmpegdec->pcache;
+
+    /* no more cached data, we assume we can consume the complete cache */
+    ffmpegdec->pcache = NULL;
+
+    GST_LOG_OBJECT (ffmpegdec, "parsing %u bytes of cached data",
+        GST_BUFFER_SIZE (pcache));
+
+    ret = gst_ffmpegdec_decode_buffer (ffmpegdec, pcache,
+        gst_ffmpeg_buffer_is_padded (pcache), GST_BUFFER_TIMESTAMP (pcache),
+        GST_BUFFER_DURATION (pcache), GST_BUFFER_OFFSET (pcache));
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      gst_buffer_unref (inbuf);
+      return ret;
+    }
+
+    /* the parser left data again, it has to go before the new data */
+    if (G_UNLIKELY (ffmpegdec->pcache)) {
+      /* use timestamp and duration of what is in the cache */
+      in_timestamp = GST_BUFFER_TIMESTAMP (ffmpegdec->pcache);
+      in_duration = GST_BUFFER_DURATION (ffmpegdec->pcache);
+      in_offset = GST_BUFFER_OFFSET (ffmpegdec->pcache);
+
+      /* join with previous data */
+      inbuf = joined = join_padded (ffmpegdec->pcache, inbuf);
+
+      GST_LOG_OBJECT (ffmpegdec,
+          "joined parse cache, inbuf now has offset %" G_GINT64_FORMAT ", ts:%"
+          GST_TIME_FORMAT, in_offset, GST_TIME_ARGS (in_timestamp));
+
+      ffmpegdec->pcache = NULL;
+    }
+  }
+
+  /* workarounds, functions write to buffers:
+   *  libavcodec/svq1.c:svq1_decode_frame writes to the given buffer.
+   *  libavcodec/svq3.c:svq3_decode_slice_header too.
+   * ffmpeg devs know about it and will fix it (they said). */
+  if (oclass->in_plugin->id == CODEC_ID_SVQ1 ||
+      oclass->in_plugin->id == CODEC_ID_SVQ3) {
+    inbuf = gst_buffer_make_writable (inbuf);
+  }
+
+  /* only trust padding we can verify, buffer flags get copied around */
+  ret = gst_ffmpegdec_decode_buffer (ffmpegdec, inbuf,
+      inbuf == joined || gst_ffmpeg_buffer_is_padded (inbuf), in_timestamp,
+      in_duration, in_offset);
+
+  return ret;
 
   /* ERRORS */
 not_negotiated:
@@ -2748,16 +3077,27 @@ gst_ffmpegdec_change_state (GstElement * element, GstStateChange transition)
 
   switch (transition) {
     case GST_STATE_CHANGE_PAUSED_TO_READY:
+    {
+      guint64 hits, misses;
+
       GST_OBJECT_LOCK (ffmpegdec);
       gst_ffmpegdec_close (ffmpegdec);
       GST_OBJECT_UNLOCK (ffmpegdec);
       clear_queued (ffmpegdec);
+      gst_ffmpeg_buffer_pool_get_stats (ffmpegdec->pool, &hits, &misses);
+      GST_DEBUG_OBJECT (ffmpegdec, "buffer pool: %" G_GUINT64_FORMAT " hits, %"
+          G_GUINT64_FORMAT " misses", hits, misses);
+      gst_ffmpeg_buffer_pool_flush (ffmpegdec->pool);
       g_free (ffmpegdec->padded);
       flush_opaque (ffmpegdec);
       ffmpegdec->padded = NULL;
       ffmpegdec->padded_size = 0;
       ffmpegdec->can_allocate_aligned = TRUE;
+      av_free (ffmpegdec->audio_scratch);
+      ffmpegdec->audio_scratch = NULL;
+      gst_buffer_replace (&ffmpegdec->audio_chunk, NULL);
       break;
+    }
     default:
       break;
   }
@@ -2792,6 +3132,15 @@ gst_ffmpegdec_set_property (GObject * object,
     case PROP_CROP:
       ffmpegdec->crop = g_value_get_boolean (value);
       break;
+    case PROP_MAX_THREADS:
+      ffmpegdec->max_threads = g_value_get_int (value);
+      break;
+    case PROP_AUDIO_SUBBUFFERS:
+      ffmpegdec->audio_subbuffers = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_REVERSE_BYTES:
+      ffmpegdec->max_reverse_bytes = g_value_get_uint64 (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2823,6 +3172,15 @@ gst_ffmpegdec_get_property (GObject * object,
     case PROP_CROP:
       g_value_set_boolean (value, ffmpegdec->crop);
       break;
+    case PROP_MAX_THREADS:
+      g_value_set_int (value, ffmpegdec->max_threads);
+      break;
+    case PROP_AUDIO_SUBBUFFERS:
+      g_value_set_boolean (value, ffmpegdec->audio_subbuffers);
+      break;
+    case PROP_MAX_REVERSE_BYTES:
+      g_value_set_uint64 (value, ffmpegdec->max_reverse_bytes);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
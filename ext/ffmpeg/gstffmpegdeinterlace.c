@@ -30,29 +30,59 @@
 #  include <libavcodec/avcodec.h>
 #endif
 
+#include <string.h>
+
 #include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
 #include <gst/video/video.h>
 
+#ifdef HAVE_ORC
+#include <orc/orc.h>
+#endif
+
 #include "gstffmpeg.h"
 #include "gstffmpegcodecmap.h"
 #include "gstffmpegutils.h"
 
-typedef struct _GstFFMpegDeinterlace
+typedef enum
 {
-  GstElement element;
+  GST_FFMPEGDEINTERLACE_MODE_LOWPASS,
+  GST_FFMPEGDEINTERLACE_MODE_INTERPOLATE,
+  GST_FFMPEGDEINTERLACE_MODE_MOTION_ADAPTIVE
+} GstFFMpegDeinterlaceMode;
 
-  GstPad *sinkpad, *srcpad;
+typedef struct _GstFFMpegDeinterlace
+{
+  GstBaseTransform parent;
 
   gint width, height;
+  gint fps_n, fps_d;
   gint to_size;
 
   enum PixelFormat pixfmt;
   AVPicture from_frame, to_frame;
+
+  /* field-rate property when the caps were negotiated */
+  gboolean active_field_rate;
+
+  /* original bottom field line for the lowpass filter */
+  guint8 *line;
+
+  /* last frames that still have the original lines of the top and the
+   * bottom field, for the motion adaptive mode */
+  GstBuffer *prev[2];
+
+  /* chain function of the base class */
+  GstPadChainFunction base_chain;
+
+  /* properties, with OBJECT_LOCK */
+  GstFFMpegDeinterlaceMode mode;
+  gboolean field_rate;
 } GstFFMpegDeinterlace;
 
 typedef struct _GstFFMpegDeinterlaceClass
 {
-  GstElementClass parent_class;
+  GstBaseTransformClass parent_class;
 } GstFFMpegDeinterlaceClass;
 
 #define GST_TYPE_FFMPEGDEINTERLACE \
@@ -68,23 +98,381 @@ typedef struct _GstFFMpegDeinterlaceClass
 
 GType gst_ffmpegdeinterlace_get_type (void);
 
+#define DEFAULT_MODE GST_FFMPEGDEINTERLACE_MODE_LOWPASS
+#define DEFAULT_FIELD_RATE FALSE
+
+/* largest difference between the kept field of two frames that still
+ * counts as a static pixel in the motion adaptive mode */
+#define MOTION_THRESHOLD 10
+
+enum
+{
+  PROP_0,
+  PROP_MODE,
+  PROP_FIELD_RATE,
+  PROP_LAST
+};
+
+#define DEINTERLACE_CAPS \
+    GST_VIDEO_CAPS_YUV ("{ I420, Y42B, Y41B, YUV9, YUY2 }") ";" \
+    GST_VIDEO_CAPS_RGB ";" GST_VIDEO_CAPS_BGR
+
 static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV ("I420"))
+    GST_STATIC_CAPS (DEINTERLACE_CAPS)
     );
 
 static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_VIDEO_CAPS_YUV ("I420"))
+    GST_STATIC_CAPS (DEINTERLACE_CAPS)
     );
 
-GST_BOILERPLATE (GstFFMpegDeinterlace, gst_ffmpegdeinterlace, GstElement,
-    GST_TYPE_ELEMENT);
+#define GST_FFMPEGDEINTERLACE_TYPE_MODE (gst_ffmpegdeinterlace_mode_get_type())
+static GType
+gst_ffmpegdeinterlace_mode_get_type (void)
+{
+  static GType ffmpegdeinterlace_mode_type = 0;
+
+  if (!ffmpegdeinterlace_mode_type) {
+    static const GEnumValue ffmpegdeinterlace_mode[] = {
+      {GST_FFMPEGDEINTERLACE_MODE_LOWPASS,
+          "Low-pass filter the bottom field against the top field, "
+            "interpolate at field rate", "lowpass"},
+      {GST_FFMPEGDEINTERLACE_MODE_INTERPOLATE,
+          "Interpolate the missing field", "interpolate"},
+      {GST_FFMPEGDEINTERLACE_MODE_MOTION_ADAPTIVE,
+          "Keep the missing field where the picture is static, interpolate "
+            "it where it moves", "motion-adaptive"},
+      {0, NULL, NULL},
+    };
+
+    ffmpegdeinterlace_mode_type =
+        g_enum_register_static ("GstFFMpegDeinterlaceMode",
+        ffmpegdeinterlace_mode);
+  }
+
+  return ffmpegdeinterlace_mode_type;
+}
+
+GST_BOILERPLATE (GstFFMpegDeinterlace, gst_ffmpegdeinterlace, GstBaseTransform,
+    GST_TYPE_BASE_TRANSFORM);
 
+static void gst_ffmpegdeinterlace_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_ffmpegdeinterlace_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstCaps *gst_ffmpegdeinterlace_transform_caps (GstBaseTransform *
+    trans, GstPadDirection direction, GstCaps * caps);
+static gboolean gst_ffmpegdeinterlace_get_unit_size (GstBaseTransform *
+    trans, GstCaps * caps, guint * size);
+static gboolean gst_ffmpegdeinterlace_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static gboolean gst_ffmpegdeinterlace_stop (GstBaseTransform * trans);
+static GstFlowReturn gst_ffmpegdeinterlace_transform_ip (GstBaseTransform *
+    trans, GstBuffer * buf);
 static GstFlowReturn gst_ffmpegdeinterlace_chain (GstPad * pad,
-    GstBuffer * inbuf);
+    GstBuffer * buf);
+
+/* Line kernels. They produce the missing line of a field, each output byte
+ * only depends on the bytes at the same position in the input lines. That
+ * way they work on all the planes of planar and packed formats alike. */
+
+/* [-1 4 2 4 -1] / 8 over both fields, the result of avpicture_deinterlace().
+ * @line is filtered in place, @m2 holds the original line 2 lines up and
+ * gets the original @line. */
+typedef void (*LowpassLineFunc) (guint8 * line, const guint8 * m1,
+    const guint8 * p1, const guint8 * p2, guint8 * m2, gint width);
+
+/* [-1 9 9 -1] / 16 over the lines of the kept field */
+typedef void (*InterpolateLineFunc) (guint8 * dest, const guint8 * m3,
+    const guint8 * m1, const guint8 * p1, const guint8 * p3, gint width);
+
+/* @line where the kept field lines above and below are within
+ * MOTION_THRESHOLD of @prev_m1 and @prev_p1, interpolated otherwise.
+ * @dest can be @line. */
+typedef void (*AdaptiveLineFunc) (guint8 * dest, const guint8 * line,
+    const guint8 * m3, const guint8 * m1, const guint8 * p1,
+    const guint8 * p3, const guint8 * prev_m1, const guint8 * prev_p1,
+    gint width);
+
+static void
+lowpass_line_c (guint8 * line, const guint8 * m1, const guint8 * p1,
+    const guint8 * p2, guint8 * m2, gint width)
+{
+  gint i, sum;
+
+  for (i = 0; i < width; i++) {
+    sum = -m2[i] + (m1[i] << 2) + (line[i] << 1) + (p1[i] << 2) - p2[i];
+    m2[i] = line[i];
+    line[i] = CLAMP ((sum + 4) >> 3, 0, 255);
+  }
+}
+
+static void
+interpolate_line_c (guint8 * dest, const guint8 * m3, const guint8 * m1,
+    const guint8 * p1, const guint8 * p3, gint width)
+{
+  gint i, sum;
+
+  for (i = 0; i < width; i++) {
+    sum = 9 * (m1[i] + p1[i]) - m3[i] - p3[i];
+    dest[i] = CLAMP ((sum + 8) >> 4, 0, 255);
+  }
+}
+
+static void
+adaptive_line_c (guint8 * dest, const guint8 * line, const guint8 * m3,
+    const guint8 * m1, const guint8 * p1, const guint8 * p3,
+    const guint8 * prev_m1, const guint8 * prev_p1, gint width)
+{
+  gint i, sum;
+
+  for (i = 0; i < width; i++) {
+    if (ABS (m1[i] - prev_m1[i]) > MOTION_THRESHOLD ||
+        ABS (p1[i] - prev_p1[i]) > MOTION_THRESHOLD) {
+      sum = 9 * (m1[i] + p1[i]) - m3[i] - p3[i];
+      dest[i] = CLAMP ((sum + 8) >> 4, 0, 255);
+    } else {
+      dest[i] = line[i];
+    }
+  }
+}
+
+#if defined (__GNUC__) && (defined (HAVE_CPU_I386) || defined (HAVE_CPU_X86_64))
+#define HAVE_SSE2_ASM 1
+
+/* the compiler only knows about the xmm registers when SSE is enabled */
+#ifdef __SSE__
+#define XMM_CLOBBERS(...) __VA_ARGS__
+#else
+#define XMM_CLOBBERS(...)
+#endif
+
+#ifdef HAVE_CPU_X86_64
+#define REG_a "rax"
+#define PTR_SIZE "8"
+#else
+#define REG_a "eax"
+#define PTR_SIZE "4"
+#endif
+
+/* The line pointers are passed in a table, there are not enough registers
+ * for all of them on i386. These load and store the 16 bytes at %[i] of
+ * line n of the table. */
+#define LOAD_LINE(n, reg) \
+    "mov   " #n "*" PTR_SIZE "(%[lines]), %%" REG_a "  \n\t" \
+    "movdqu      (%%" REG_a ", %[i]), " reg "         \n\t"
+#define STORE_LINE(reg, n) \
+    "mov   " #n "*" PTR_SIZE "(%[lines]), %%" REG_a "  \n\t" \
+    "movdqu      " reg ", (%%" REG_a ", %[i])         \n\t"
+
+#define V16(p) (*(const guint8 (*)[16]) (p))
+
+static const guint16 pw_4[8] = { 4, 4, 4, 4, 4, 4, 4, 4 };
+static const guint16 pw_8[8] = { 8, 8, 8, 8, 8, 8, 8, 8 };
+
+static const guint8 pb_threshold[16] = {
+  MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD,
+  MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD,
+  MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD,
+  MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD, MOTION_THRESHOLD
+};
+
+/* xmm2 = [-1 9 9 -1] / 16 of the lines 1 to 4 of the table, needs a zero
+ * xmm7 */
+#define INTERPOLATE_SSE2 \
+    LOAD_LINE (2, "%%xmm0") \
+    LOAD_LINE (3, "%%xmm1") \
+    "movdqa          %%xmm0, %%xmm2     \n\t" \
+    "movdqa          %%xmm1, %%xmm3     \n\t" \
+    "punpcklbw       %%xmm7, %%xmm2     \n\t" \
+    "punpcklbw       %%xmm7, %%xmm3     \n\t" \
+    "punpckhbw       %%xmm7, %%xmm0     \n\t" \
+    "punpckhbw       %%xmm7, %%xmm1     \n\t" \
+    "paddw           %%xmm3, %%xmm2     \n\t" \
+    "paddw           %%xmm1, %%xmm0     \n\t" \
+    "movdqa          %%xmm2, %%xmm3     \n\t" \
+    "movdqa          %%xmm0, %%xmm1     \n\t" \
+    "psllw               $3, %%xmm2     \n\t" \
+    "psllw               $3, %%xmm0     \n\t" \
+    "paddw           %%xmm3, %%xmm2     \n\t" \
+    "paddw           %%xmm1, %%xmm0     \n\t" \
+    "movdqu           %[pw8], %%xmm1    \n\t" \
+    "paddw           %%xmm1, %%xmm2     \n\t" \
+    "paddw           %%xmm1, %%xmm0     \n\t" \
+    LOAD_LINE (1, "%%xmm1") \
+    LOAD_LINE (4, "%%xmm3") \
+    "movdqa          %%xmm1, %%xmm4     \n\t" \
+    "movdqa          %%xmm3, %%xmm5     \n\t" \
+    "punpcklbw       %%xmm7, %%xmm1     \n\t" \
+    "punpcklbw       %%xmm7, %%xmm3     \n\t" \
+    "punpckhbw       %%xmm7, %%xmm4     \n\t" \
+    "punpckhbw       %%xmm7, %%xmm5     \n\t" \
+    "paddw           %%xmm3, %%xmm1     \n\t" \
+    "paddw           %%xmm5, %%xmm4     \n\t" \
+    "psubusw         %%xmm1, %%xmm2     \n\t" \
+    "psubusw         %%xmm4, %%xmm0     \n\t" \
+    "psrlw               $4, %%xmm2     \n\t" \
+    "psrlw               $4, %%xmm0     \n\t" \
+    "packuswb        %%xmm0, %%xmm2     \n\t"
+
+static void
+lowpass_line_sse2 (guint8 * line, const guint8 * m1, const guint8 * p1,
+    const guint8 * p2, guint8 * m2, gint width)
+{
+  const guint8 *lines[5] = { line, m1, p1, p2, m2 };
+  gssize i = 0, n = width & ~15;
+
+  if (n > 0) {
+    __asm__ __volatile__ (
+        "pxor            %%xmm7, %%xmm7     \n\t"
+        "1:                                 \n\t"
+        LOAD_LINE (4, "%%xmm0")
+        LOAD_LINE (0, "%%xmm1")
+        STORE_LINE ("%%xmm1", 4)
+        /* 4 * (m1 + p1) */
+        LOAD_LINE (1, "%%xmm2")
+        LOAD_LINE (2, "%%xmm3")
+        "movdqa          %%xmm2, %%xmm5     \n\t"
+        "movdqa          %%xmm3, %%xmm6     \n\t"
+        "punpcklbw       %%xmm7, %%xmm2     \n\t"
+        "punpcklbw       %%xmm7, %%xmm3     \n\t"
+        "punpckhbw       %%xmm7, %%xmm5     \n\t"
+        "punpckhbw       %%xmm7, %%xmm6     \n\t"
+        "paddw           %%xmm3, %%xmm2     \n\t"
+        "paddw           %%xmm6, %%xmm5     \n\t"
+        "psllw               $2, %%xmm2     \n\t"
+        "psllw               $2, %%xmm5     \n\t"
+        /* + 2 * line + 4 */
+        "movdqa          %%xmm1, %%xmm3     \n\t"
+        "punpcklbw       %%xmm7, %%xmm1     \n\t"
+        "punpckhbw       %%xmm7, %%xmm3     \n\t"
+        "psllw               $1, %%xmm1     \n\t"
+        "psllw               $1, %%xmm3     \n\t"
+        "paddw           %%xmm1, %%xmm2     \n\t"
+        "paddw           %%xmm3, %%xmm5     \n\t"
+        "movdqu           %[pw4], %%xmm6    \n\t"
+        "paddw           %%xmm6, %%xmm2     \n\t"
+        "paddw           %%xmm6, %%xmm5     \n\t"
+        /* - (m2 + p2), negative sums saturate to 0 */
+        LOAD_LINE (3, "%%xmm4")
+        "movdqa          %%xmm0, %%xmm1     \n\t"
+        "movdqa          %%xmm4, %%xmm3     \n\t"
+        "punpcklbw       %%xmm7, %%xmm0     \n\t"
+        "punpcklbw       %%xmm7, %%xmm4     \n\t"
+        "punpckhbw       %%xmm7, %%xmm1     \n\t"
+        "punpckhbw       %%xmm7, %%xmm3     \n\t"
+        "paddw           %%xmm4, %%xmm0     \n\t"
+        "paddw           %%xmm3, %%xmm1     \n\t"
+        "psubusw         %%xmm0, %%xmm2     \n\t"
+        "psubusw         %%xmm1, %%xmm5     \n\t"
+        "psrlw               $3, %%xmm2     \n\t"
+        "psrlw               $3, %%xmm5     \n\t"
+        "packuswb        %%xmm5, %%xmm2     \n\t"
+        STORE_LINE ("%%xmm2", 0)
+        "add                $16, %[i]       \n\t"
+        "cmp                %[n], %[i]      \n\t"
+        " jb                 1b             \n\t"
+        : [i] "+r" (i)
+        : [lines] "r" (lines), [n] "rm" (n), [pw4] "m" (V16 (pw_4))
+        : "%" REG_a, "memory"
+          XMM_CLOBBERS (, "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4",
+              "%xmm5", "%xmm6", "%xmm7")
+    );
+  }
+
+  if (i < width)
+    lowpass_line_c (line + i, m1 + i, p1 + i, p2 + i, m2 + i, width - i);
+}
+
+static void
+interpolate_line_sse2 (guint8 * dest, const guint8 * m3, const guint8 * m1,
+    const guint8 * p1, const guint8 * p3, gint width)
+{
+  const guint8 *lines[5] = { dest, m3, m1, p1, p3 };
+  gssize i = 0, n = width & ~15;
+
+  if (n > 0) {
+    __asm__ __volatile__ (
+        "pxor            %%xmm7, %%xmm7     \n\t"
+        "1:                                 \n\t"
+        INTERPOLATE_SSE2
+        STORE_LINE ("%%xmm2", 0)
+        "add                $16, %[i]       \n\t"
+        "cmp                %[n], %[i]      \n\t"
+        " jb                 1b             \n\t"
+        : [i] "+r" (i)
+        : [lines] "r" (lines), [n] "rm" (n), [pw8] "m" (V16 (pw_8))
+        : "%" REG_a, "memory"
+          XMM_CLOBBERS (, "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4",
+              "%xmm5", "%xmm7")
+    );
+  }
+
+  if (i < width)
+    interpolate_line_c (dest + i, m3 + i, m1 + i, p1 + i, p3 + i, width - i);
+}
+
+static void
+adaptive_line_sse2 (guint8 * dest, const guint8 * line, const guint8 * m3,
+    const guint8 * m1, const guint8 * p1, const guint8 * p3,
+    const guint8 * prev_m1, const guint8 * prev_p1, gint width)
+{
+  const guint8 *lines[8] = { dest, m3, m1, p1, p3, line, prev_m1, prev_p1 };
+  gssize i = 0, n = width & ~15;
+
+  if (n > 0) {
+    __asm__ __volatile__ (
+        "pxor            %%xmm7, %%xmm7     \n\t"
+        "movdqu     %[threshold], %%xmm6    \n\t"
+        "1:                                 \n\t"
+        INTERPOLATE_SSE2
+        /* largest absolute difference to the previous kept field */
+        LOAD_LINE (2, "%%xmm0")
+        LOAD_LINE (6, "%%xmm1")
+        "movdqa          %%xmm0, %%xmm3     \n\t"
+        "psubusb         %%xmm1, %%xmm0     \n\t"
+        "psubusb         %%xmm3, %%xmm1     \n\t"
+        "por             %%xmm1, %%xmm0     \n\t"
+        LOAD_LINE (3, "%%xmm1")
+        LOAD_LINE (7, "%%xmm4")
+        "movdqa          %%xmm1, %%xmm3     \n\t"
+        "psubusb         %%xmm4, %%xmm1     \n\t"
+        "psubusb         %%xmm3, %%xmm4     \n\t"
+        "por             %%xmm4, %%xmm1     \n\t"
+        "pmaxub          %%xmm1, %%xmm0     \n\t"
+        /* 0xff for the static pixels */
+        "psubusb         %%xmm6, %%xmm0     \n\t"
+        "pcmpeqb         %%xmm7, %%xmm0     \n\t"
+        LOAD_LINE (5, "%%xmm1")
+        "pand            %%xmm0, %%xmm1     \n\t"
+        "pandn           %%xmm2, %%xmm0     \n\t"
+        "por             %%xmm1, %%xmm0     \n\t"
+        STORE_LINE ("%%xmm0", 0)
+        "add                $16, %[i]       \n\t"
+        "cmp                %[n], %[i]      \n\t"
+        " jb                 1b             \n\t"
+        : [i] "+r" (i)
+        : [lines] "r" (lines), [n] "rm" (n), [pw8] "m" (V16 (pw_8)),
+          [threshold] "m" (V16 (pb_threshold))
+        : "%" REG_a, "memory"
+          XMM_CLOBBERS (, "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4",
+              "%xmm5", "%xmm6", "%xmm7")
+    );
+  }
+
+  if (i < width)
+    adaptive_line_c (dest + i, line + i, m3 + i, m1 + i, p1 + i, p3 + i,
+        prev_m1 + i, prev_p1 + i, width - i);
+}
+#endif /* HAVE_SSE2_ASM */
+
+static LowpassLineFunc lowpass_line = lowpass_line_c;
+static InterpolateLineFunc interpolate_line = interpolate_line_c;
+static AdaptiveLineFunc adaptive_line = adaptive_line_c;
 
 static void
 gst_ffmpegdeinterlace_base_init (gpointer g_class)
@@ -103,101 +491,544 @@ gst_ffmpegdeinterlace_base_init (gpointer g_class)
 static void
 gst_ffmpegdeinterlace_class_init (GstFFMpegDeinterlaceClass * klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+#ifdef HAVE_SSE2_ASM
+  gboolean sse2;
+#endif
+
+  gobject_class->set_property = gst_ffmpegdeinterlace_set_property;
+  gobject_class->get_property = gst_ffmpegdeinterlace_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_MODE,
+      g_param_spec_enum ("mode", "Mode", "Deinterlacing method",
+          GST_FFMPEGDEINTERLACE_TYPE_MODE, DEFAULT_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FIELD_RATE,
+      g_param_spec_boolean ("field-rate", "Field rate",
+          "Output a frame for every field, at twice the input frame rate. "
+          "Only takes effect when the caps are negotiated",
+          DEFAULT_FIELD_RATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  trans_class->transform_caps =
+      GST_DEBUG_FUNCPTR (gst_ffmpegdeinterlace_transform_caps);
+  trans_class->get_unit_size =
+      GST_DEBUG_FUNCPTR (gst_ffmpegdeinterlace_get_unit_size);
+  trans_class->set_caps = GST_DEBUG_FUNCPTR (gst_ffmpegdeinterlace_set_caps);
+  trans_class->stop = GST_DEBUG_FUNCPTR (gst_ffmpegdeinterlace_stop);
+  trans_class->transform_ip =
+      GST_DEBUG_FUNCPTR (gst_ffmpegdeinterlace_transform_ip);
+
+#ifdef HAVE_SSE2_ASM
+#ifdef HAVE_ORC
+  sse2 = (orc_target_get_default_flags (orc_target_get_by_name ("sse")) &
+      ORC_TARGET_SSE_SSE2) != 0;
+#elif defined (__SSE2__)
+  sse2 = TRUE;
+#else
+  sse2 = FALSE;
+#endif
+  if (sse2) {
+    GST_DEBUG ("using the SSE2 deinterlacing kernels");
+    lowpass_line = lowpass_line_sse2;
+    interpolate_line = interpolate_line_sse2;
+    adaptive_line = adaptive_line_sse2;
+  }
+#endif
+}
+
+static void
+gst_ffmpegdeinterlace_init (GstFFMpegDeinterlace * deinterlace,
+    GstFFMpegDeinterlaceClass * klass)
+{
+  GstPad *sinkpad = GST_BASE_TRANSFORM_SINK_PAD (deinterlace);
+
+  gst_base_transform_set_in_place (GST_BASE_TRANSFORM (deinterlace), TRUE);
+
+  deinterlace->base_chain = GST_PAD_CHAINFUNC (sinkpad);
+  gst_pad_set_chain_function (sinkpad,
+      GST_DEBUG_FUNCPTR (gst_ffmpegdeinterlace_chain));
+
+  deinterlace->pixfmt = PIX_FMT_NB;
+  deinterlace->line = NULL;
+  deinterlace->prev[0] = NULL;
+  deinterlace->prev[1] = NULL;
+
+  deinterlace->mode = DEFAULT_MODE;
+  deinterlace->field_rate = DEFAULT_FIELD_RATE;
+}
+
+static void
+gst_ffmpegdeinterlace_reset_prev (GstFFMpegDeinterlace * deinterlace)
+{
+  gint i;
+
+  for (i = 0; i < 2; i++) {
+    if (deinterlace->prev[i]) {
+      gst_buffer_unref (deinterlace->prev[i]);
+      deinterlace->prev[i] = NULL;
+    }
+  }
+}
+
+static void
+gst_ffmpegdeinterlace_set_prev (GstFFMpegDeinterlace * deinterlace,
+    gint field, GstBuffer * buf)
+{
+  if (deinterlace->prev[field])
+    gst_buffer_unref (deinterlace->prev[field]);
+  deinterlace->prev[field] = gst_buffer_ref (buf);
 }
 
 static gboolean
-gst_ffmpegdeinterlace_sink_setcaps (GstPad * pad, GstCaps * caps)
+gst_ffmpegdeinterlace_parse_caps (GstCaps * caps, enum PixelFormat *pixfmt,
+    gint * width, gint * height)
 {
-  GstFFMpegDeinterlace *deinterlace =
-      GST_FFMPEGDEINTERLACE (gst_pad_get_parent (pad));
   GstStructure *structure = gst_caps_get_structure (caps, 0);
   AVCodecContext *ctx;
-  GValue interlaced = { 0 };
-  GstCaps *srcCaps;
-  GstFlowReturn ret;
 
-  if (!gst_structure_get_int (structure, "width", &deinterlace->width))
+  if (!gst_structure_get_int (structure, "width", width))
     return FALSE;
-  if (!gst_structure_get_int (structure, "height", &deinterlace->height))
+  if (!gst_structure_get_int (structure, "height", height))
     return FALSE;
 
   ctx = avcodec_alloc_context ();
-  ctx->width = deinterlace->width;
-  ctx->height = deinterlace->height;
+  ctx->width = *width;
+  ctx->height = *height;
   ctx->pix_fmt = PIX_FMT_NB;
   gst_ffmpeg_caps_with_codectype (CODEC_TYPE_VIDEO, caps, ctx);
-  if (ctx->pix_fmt == PIX_FMT_NB) {
-    av_free (ctx);
-    return FALSE;
+  *pixfmt = ctx->pix_fmt;
+  av_free (ctx);
+
+  /* the line kernels work on bytes, so all components must be bytes */
+  switch (*pixfmt) {
+    case PIX_FMT_YUV420P:
+    case PIX_FMT_YUV422P:
+    case PIX_FMT_YUV411P:
+    case PIX_FMT_YUV410P:
+    case PIX_FMT_YUYV422:
+    case PIX_FMT_RGB24:
+    case PIX_FMT_BGR24:
+      return TRUE;
+    default:
+      return FALSE;
   }
+}
+
+static GstCaps *
+gst_ffmpegdeinterlace_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps)
+{
+  GstFFMpegDeinterlace *deinterlace = GST_FFMPEGDEINTERLACE (trans);
+  GstCaps *ret;
+  gboolean field_rate;
+  gint i, n, d;
 
-  deinterlace->pixfmt = ctx->pix_fmt;
+  GST_OBJECT_LOCK (deinterlace);
+  field_rate = deinterlace->field_rate;
+  GST_OBJECT_UNLOCK (deinterlace);
 
-  av_free (ctx);
+  ret = gst_caps_copy (caps);
+
+  for (i = 0; i < gst_caps_get_size (ret); i++) {
+    GstStructure *structure = gst_caps_get_structure (ret, i);
+
+    if (direction == GST_PAD_SINK)
+      gst_structure_set (structure, "interlaced", G_TYPE_BOOLEAN, FALSE,
+          NULL);
+    else
+      gst_structure_remove_field (structure, "interlaced");
+
+    if (!field_rate)
+      continue;
+
+    /* a frame for each field */
+    if (gst_structure_get_fraction (structure, "framerate", &n, &d)) {
+      if (direction == GST_PAD_SINK) {
+        if (d % 2 == 0)
+          d /= 2;
+        else
+          n *= 2;
+      } else {
+        if (n % 2 == 0)
+          n /= 2;
+        else
+          d *= 2;
+      }
+      gst_structure_set (structure, "framerate", GST_TYPE_FRACTION, n, d,
+          NULL);
+    } else {
+      gst_structure_remove_field (structure, "framerate");
+    }
+  }
+
+  GST_DEBUG_OBJECT (deinterlace, "transformed %" GST_PTR_FORMAT " to %"
+      GST_PTR_FORMAT, caps, ret);
+
+  return ret;
+}
+
+static gboolean
+gst_ffmpegdeinterlace_get_unit_size (GstBaseTransform * trans, GstCaps * caps,
+    guint * size)
+{
+  enum PixelFormat pixfmt;
+  gint width, height;
+
+  if (!gst_ffmpegdeinterlace_parse_caps (caps, &pixfmt, &width, &height))
+    return FALSE;
+
+  *size = gst_ffmpeg_avpicture_get_size (pixfmt, width, height);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ffmpegdeinterlace_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstFFMpegDeinterlace *deinterlace = GST_FFMPEGDEINTERLACE (trans);
+  GstStructure *structure = gst_caps_get_structure (incaps, 0);
+
+  if (!gst_ffmpegdeinterlace_parse_caps (incaps, &deinterlace->pixfmt,
+          &deinterlace->width, &deinterlace->height))
+    return FALSE;
+
+  if (!gst_structure_get_fraction (structure, "framerate",
+          &deinterlace->fps_n, &deinterlace->fps_d)) {
+    deinterlace->fps_n = 0;
+    deinterlace->fps_d = 1;
+  }
 
   deinterlace->to_size =
-      avpicture_get_size (deinterlace->pixfmt, deinterlace->width,
+      gst_ffmpeg_avpicture_get_size (deinterlace->pixfmt, deinterlace->width,
       deinterlace->height);
 
-  srcCaps = gst_caps_copy (caps);
-  g_value_init (&interlaced, G_TYPE_BOOLEAN);
-  g_value_set_boolean (&interlaced, FALSE);
-  gst_caps_set_value (srcCaps, "interlaced", &interlaced);
-  g_value_unset (&interlaced);
+  GST_OBJECT_LOCK (deinterlace);
+  deinterlace->active_field_rate = deinterlace->field_rate;
+  GST_OBJECT_UNLOCK (deinterlace);
 
-  ret = gst_pad_set_caps (deinterlace->srcpad, srcCaps);
-  gst_caps_unref (srcCaps);
-  return ret;
+  /* plane 0 has the longest lines */
+  gst_ffmpeg_avpicture_fill (&deinterlace->from_frame, NULL,
+      deinterlace->pixfmt, deinterlace->width, deinterlace->height);
+  g_free (deinterlace->line);
+  deinterlace->line = g_malloc (deinterlace->from_frame.linesize[0]);
+
+  gst_ffmpegdeinterlace_reset_prev (deinterlace);
+
+  GST_DEBUG_OBJECT (deinterlace, "%dx%d, pixfmt %d, field rate %d",
+      deinterlace->width, deinterlace->height, deinterlace->pixfmt,
+      deinterlace->active_field_rate);
+
+  return TRUE;
 }
 
+static gboolean
+gst_ffmpegdeinterlace_stop (GstBaseTransform * trans)
+{
+  GstFFMpegDeinterlace *deinterlace = GST_FFMPEGDEINTERLACE (trans);
+
+  gst_ffmpegdeinterlace_reset_prev (deinterlace);
+  g_free (deinterlace->line);
+  deinterlace->line = NULL;
+  deinterlace->pixfmt = PIX_FMT_NB;
+
+  return TRUE;
+}
+
+static gint
+plane_height (GstFFMpegDeinterlace * deinterlace, gint plane)
+{
+  gint h_shift, v_shift;
+
+  if (plane == 0)
+    return deinterlace->height;
+
+  avcodec_get_chroma_sub_sample (deinterlace->pixfmt, &h_shift, &v_shift);
+
+  return -((-deinterlace->height) >> v_shift);
+}
+
+/* filters the bottom field of a plane in place, like
+ * avpicture_deinterlace() */
 static void
-gst_ffmpegdeinterlace_init (GstFFMpegDeinterlace * deinterlace,
-    GstFFMpegDeinterlaceClass * klass)
+lowpass_plane (GstFFMpegDeinterlace * deinterlace, guint8 * data,
+    gint stride, gint height)
 {
-  deinterlace->sinkpad =
-      gst_pad_new_from_static_template (&sink_factory, "sink");
-  gst_pad_set_setcaps_function (deinterlace->sinkpad,
-      gst_ffmpegdeinterlace_sink_setcaps);
-  gst_pad_set_chain_function (deinterlace->sinkpad,
-      gst_ffmpegdeinterlace_chain);
-  gst_element_add_pad (GST_ELEMENT (deinterlace), deinterlace->sinkpad);
+  guint8 *line;
+  gint y;
 
-  deinterlace->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
-  gst_element_add_pad (GST_ELEMENT (deinterlace), deinterlace->srcpad);
+  memcpy (deinterlace->line, data, stride);
 
-  deinterlace->pixfmt = PIX_FMT_NB;
+  for (y = 1; y < height; y += 2) {
+    line = data + y * stride;
+
+    lowpass_line (line, line - stride,
+        y + 1 < height ? line + stride : line,
+        y + 2 < height ? line + 2 * stride : line, deinterlace->line, stride);
+  }
+}
+
+/* Writes the lines of @field, 0 for top and 1 for bottom, of @src to @dest
+ * and fills the lines of the other field. @dest can be @src. */
+static void
+deinterlace_plane (GstFFMpegDeinterlace * deinterlace, guint8 * dest,
+    const guint8 * src, const guint8 * prev, gint stride, gint height,
+    gint field)
+{
+  gint y, last;
+
+  if (dest != src) {
+    for (y = field; y < height; y += 2)
+      memcpy (dest + y * stride, src + y * stride, stride);
+  }
+
+  /* a single line and nothing of the kept field, leave it as it is */
+  if (height <= field) {
+    if (dest != src)
+      memcpy (dest, src, stride);
+    return;
+  }
+
+  /* last line of the kept field, the lines around the missing ones are
+   * clamped to the kept field */
+  last = height - 1 - ((height - 1 - field) & 1);
+
+#define KEPT(l) (src + CLAMP ((l), field, last) * stride)
+  for (y = !field; y < height; y += 2) {
+    if (prev) {
+      adaptive_line (dest + y * stride, src + y * stride, KEPT (y - 3),
+          KEPT (y - 1), KEPT (y + 1), KEPT (y + 3),
+          prev + (KEPT (y - 1) - src), prev + (KEPT (y + 1) - src), stride);
+    } else {
+      interpolate_line (dest + y * stride, KEPT (y - 3), KEPT (y - 1),
+          KEPT (y + 1), KEPT (y + 3), stride);
+    }
+  }
+#undef KEPT
+}
+
+/* keeps @field of @src in @dest and replaces the other one */
+static void
+gst_ffmpegdeinterlace_process (GstFFMpegDeinterlace * deinterlace,
+    GstFFMpegDeinterlaceMode mode, AVPicture * dest, AVPicture * src,
+    gint field)
+{
+  AVPicture prev_frame;
+  GstBuffer *prev = NULL;
+  gint i;
+
+  /* at field rate the missing field is interpolated instead */
+  if (mode == GST_FFMPEGDEINTERLACE_MODE_LOWPASS &&
+      !deinterlace->active_field_rate) {
+    for (i = 0; i < 4 && src->data[i]; i++)
+      lowpass_plane (deinterlace, src->data[i], src->linesize[i],
+          plane_height (deinterlace, i));
+    return;
+  }
+
+  if (mode == GST_FFMPEGDEINTERLACE_MODE_MOTION_ADAPTIVE)
+    prev = deinterlace->prev[field];
+  if (prev) {
+    gst_ffmpeg_avpicture_fill (&prev_frame, GST_BUFFER_DATA (prev),
+        deinterlace->pixfmt, deinterlace->width, deinterlace->height);
+  }
+
+  for (i = 0; i < 4 && src->data[i]; i++) {
+    deinterlace_plane (deinterlace, dest->data[i], src->data[i],
+        prev ? prev_frame.data[i] : NULL, src->linesize[i],
+        plane_height (deinterlace, i), field);
+  }
+}
+
+static GstFlowReturn
+gst_ffmpegdeinterlace_transform_ip (GstBaseTransform * trans, GstBuffer * buf)
+{
+  GstFFMpegDeinterlace *deinterlace = GST_FFMPEGDEINTERLACE (trans);
+  GstFFMpegDeinterlaceMode mode;
+  gboolean adaptive;
+
+  if (G_UNLIKELY (deinterlace->pixfmt == PIX_FMT_NB))
+    goto not_negotiated;
+
+  if (G_UNLIKELY (GST_BUFFER_SIZE (buf) < deinterlace->to_size))
+    goto wrong_size;
+
+  GST_OBJECT_LOCK (deinterlace);
+  mode = deinterlace->mode;
+  GST_OBJECT_UNLOCK (deinterlace);
+
+  /* after a discont, or when changing modes, we start over without
+   * previous frames */
+  adaptive = mode == GST_FFMPEGDEINTERLACE_MODE_MOTION_ADAPTIVE;
+  if (!adaptive || GST_BUFFER_IS_DISCONT (buf))
+    gst_ffmpegdeinterlace_reset_prev (deinterlace);
+
+  gst_ffmpeg_avpicture_fill (&deinterlace->from_frame,
+      GST_BUFFER_DATA (buf), deinterlace->pixfmt, deinterlace->width,
+      deinterlace->height);
+  gst_ffmpegdeinterlace_process (deinterlace, mode, &deinterlace->from_frame,
+      &deinterlace->from_frame, 0);
+
+  if (adaptive)
+    gst_ffmpegdeinterlace_set_prev (deinterlace, 0, buf);
+
+  return GST_FLOW_OK;
+
+  /* ERRORS */
+not_negotiated:
+  {
+    GST_ELEMENT_ERROR (deinterlace, CORE, NEGOTIATION, (NULL),
+        ("format wasn't negotiated before transform function"));
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+wrong_size:
+  {
+    GST_ELEMENT_ERROR (deinterlace, STREAM, FORMAT, (NULL),
+        ("buffer too small for %dx%d frames", deinterlace->width,
+            deinterlace->height));
+    return GST_FLOW_ERROR;
+  }
 }
 
+/* At field rate every input frame gives two output frames, which the base
+ * class can't do. The first field goes into a new buffer, the second one is
+ * done in place, and both are pushed from here. Everything else goes through
+ * the chain function of the base class. */
 static GstFlowReturn
-gst_ffmpegdeinterlace_chain (GstPad * pad, GstBuffer * inbuf)
+gst_ffmpegdeinterlace_chain (GstPad * pad, GstBuffer * buf)
 {
   GstFFMpegDeinterlace *deinterlace =
-      GST_FFMPEGDEINTERLACE (gst_pad_get_parent (pad));
+      GST_FFMPEGDEINTERLACE (GST_OBJECT_PARENT (pad));
+  GstPad *srcpad = GST_BASE_TRANSFORM_SRC_PAD (deinterlace);
+  GstFFMpegDeinterlaceMode mode;
+  GstClockTime timestamp, duration;
   GstBuffer *outbuf = NULL;
   GstFlowReturn result;
+  gboolean adaptive;
+  gint field;
 
-  result =
-      gst_pad_alloc_buffer (deinterlace->srcpad, GST_BUFFER_OFFSET_NONE,
-      deinterlace->to_size, GST_PAD_CAPS (deinterlace->srcpad), &outbuf);
-  if (result == GST_FLOW_OK) {
-    gst_ffmpeg_avpicture_fill (&deinterlace->from_frame,
-        GST_BUFFER_DATA (inbuf), deinterlace->pixfmt, deinterlace->width,
-        deinterlace->height);
+  if (deinterlace->pixfmt == PIX_FMT_NB || !deinterlace->active_field_rate)
+    return deinterlace->base_chain (pad, buf);
 
-    gst_ffmpeg_avpicture_fill (&deinterlace->to_frame, GST_BUFFER_DATA (outbuf),
-        deinterlace->pixfmt, deinterlace->width, deinterlace->height);
+  if (G_UNLIKELY (GST_BUFFER_SIZE (buf) < deinterlace->to_size))
+    goto wrong_size;
 
-    avpicture_deinterlace (&deinterlace->to_frame, &deinterlace->from_frame,
-        deinterlace->pixfmt, deinterlace->width, deinterlace->height);
+  GST_OBJECT_LOCK (deinterlace);
+  mode = deinterlace->mode;
+  GST_OBJECT_UNLOCK (deinterlace);
 
-    gst_buffer_copy_metadata (outbuf, inbuf, GST_BUFFER_COPY_TIMESTAMPS);
+  adaptive = mode == GST_FFMPEGDEINTERLACE_MODE_MOTION_ADAPTIVE;
+  if (!adaptive || GST_BUFFER_IS_DISCONT (buf))
+    gst_ffmpegdeinterlace_reset_prev (deinterlace);
 
-    result = gst_pad_push (deinterlace->srcpad, outbuf);
+  field = GST_BUFFER_FLAG_IS_SET (buf, GST_VIDEO_BUFFER_TFF) ? 0 : 1;
+
+  result = gst_pad_alloc_buffer_and_set_caps (srcpad, GST_BUFFER_OFFSET_NONE,
+      deinterlace->to_size, GST_PAD_CAPS (srcpad), &outbuf);
+  if (result != GST_FLOW_OK) {
+    gst_buffer_unref (buf);
+    return result;
+  }
+  if (G_UNLIKELY (GST_BUFFER_SIZE (outbuf) < deinterlace->to_size)) {
+    gst_buffer_unref (outbuf);
+    goto wrong_size;
   }
 
-  gst_buffer_unref (inbuf);
+  buf = gst_buffer_make_writable (buf);
+  gst_buffer_set_caps (buf, GST_PAD_CAPS (srcpad));
+
+  gst_ffmpeg_avpicture_fill (&deinterlace->from_frame,
+      GST_BUFFER_DATA (buf), deinterlace->pixfmt, deinterlace->width,
+      deinterlace->height);
+  gst_ffmpeg_avpicture_fill (&deinterlace->to_frame,
+      GST_BUFFER_DATA (outbuf), deinterlace->pixfmt, deinterlace->width,
+      deinterlace->height);
+  gst_ffmpegdeinterlace_process (deinterlace, mode, &deinterlace->to_frame,
+      &deinterlace->from_frame, field);
+  if (adaptive)
+    gst_ffmpegdeinterlace_set_prev (deinterlace, field, outbuf);
+
+  gst_ffmpegdeinterlace_process (deinterlace, mode, &deinterlace->from_frame,
+      &deinterlace->from_frame, !field);
+  if (adaptive)
+    gst_ffmpegdeinterlace_set_prev (deinterlace, !field, buf);
+
+  timestamp = GST_BUFFER_TIMESTAMP (buf);
+  duration = GST_BUFFER_DURATION (buf);
+  if (!GST_CLOCK_TIME_IS_VALID (duration) && deinterlace->fps_n > 0)
+    duration = gst_util_uint64_scale_int (GST_SECOND, deinterlace->fps_d,
+        deinterlace->fps_n);
+
+  gst_buffer_copy_metadata (outbuf, buf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS);
+  GST_BUFFER_FLAG_UNSET (buf, GST_BUFFER_FLAG_DISCONT);
+  if (GST_CLOCK_TIME_IS_VALID (duration)) {
+    GST_BUFFER_DURATION (outbuf) = duration / 2;
+    GST_BUFFER_DURATION (buf) = duration - duration / 2;
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+      GST_BUFFER_TIMESTAMP (buf) = timestamp + duration / 2;
+  }
+
+  result = gst_pad_push (srcpad, outbuf);
+  if (result != GST_FLOW_OK) {
+    gst_buffer_unref (buf);
+    return result;
+  }
 
-  return result;
+  return gst_pad_push (srcpad, buf);
+
+  /* ERRORS */
+wrong_size:
+  {
+    GST_ELEMENT_ERROR (deinterlace, STREAM, FORMAT, (NULL),
+        ("buffer too small for %dx%d frames", deinterlace->width,
+            deinterlace->height));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+}
+
+static void
+gst_ffmpegdeinterlace_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFFMpegDeinterlace *deinterlace = GST_FFMPEGDEINTERLACE (object);
+
+  GST_OBJECT_LOCK (deinterlace);
+  switch (prop_id) {
+    case PROP_MODE:
+      deinterlace->mode = g_value_get_enum (value);
+      break;
+    case PROP_FIELD_RATE:
+      deinterlace->field_rate = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (deinterlace);
+}
+
+static void
+gst_ffmpegdeinterlace_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstFFMpegDeinterlace *deinterlace = GST_FFMPEGDEINTERLACE (object);
+
+  GST_OBJECT_LOCK (deinterlace);
+  switch (prop_id) {
+    case PROP_MODE:
+      g_value_set_enum (value, deinterlace->mode);
+      break;
+    case PROP_FIELD_RATE:
+      g_value_set_boolean (value, deinterlace->field_rate);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (deinterlace);
 }
 
 gboolean
@@ -24,6 +24,7 @@
 #endif
 
 #include <string.h>
+#include <glib/gstdio.h>
 #ifdef HAVE_FFMPEG_UNINSTALLED
 #include <avformat.h>
 #ifdef HAVE_AVI_H
@@ -58,6 +59,16 @@ struct _GstFFStream
   GstFlowReturn last_flow;
 
   GstTagList *tags;             /* stream tags */
+
+  /* output queue and push task, only used with stream-queues */
+  GstFFMpegDemux *demux;
+  GQueue *queue;
+  GMutex *qlock;
+  GCond *qcond;
+  gboolean qflushing;
+  guint queued_bytes;
+  GstClockTime queue_in_ts;
+  GstClockTime queue_out_ts;
 };
 
 struct _GstFFMpegDemux
@@ -99,8 +110,63 @@ struct _GstFFMpegDemux
   GstFFMpegPipe ffpipe;
   GstTask *task;
   GStaticRecMutex *task_lock;
+
+  /* seek index cache */
+  gboolean index_cache;
+  gchar *index_cache_file;
+  gchar *index_cache_key;
+  guint index_cache_entries;
+
+  /* stream info probing */
+  guint probe_size;
+  guint64 analyze_duration;
+
+  /* per stream output queues */
+  gboolean stream_queues;
+  guint queue_max_bytes;
+  guint64 queue_max_time;
+
+  /* read-ahead cache of the gstreamer:// protocol in pull mode */
+  guint cache_block_size;
+  guint cache_blocks;
+  guint64 cache_hits;
+  guint64 cache_misses;
+};
+
+enum
+{
+  PROP_0,
+  PROP_INDEX_CACHE,
+  PROP_PROBE_SIZE,
+  PROP_ANALYZE_DURATION,
+  PROP_STREAM_QUEUES,
+  PROP_QUEUE_MAX_BYTES,
+  PROP_QUEUE_MAX_TIME,
+  PROP_CACHE_BLOCK_SIZE,
+  PROP_CACHE_BLOCKS,
+  PROP_CACHE_HITS,
+  PROP_CACHE_MISSES,
+  PROP_LAST
 };
 
+#define DEFAULT_INDEX_CACHE FALSE
+#define DEFAULT_PROBE_SIZE 0
+#define DEFAULT_ANALYZE_DURATION 0
+#define DEFAULT_STREAM_QUEUES FALSE
+#define DEFAULT_QUEUE_MAX_BYTES (2 * 1024 * 1024)
+#define DEFAULT_QUEUE_MAX_TIME GST_SECOND
+#define DEFAULT_CACHE_BLOCK_SIZE GST_FFMPEG_URL_DEFAULT_BLOCK_SIZE
+#define DEFAULT_CACHE_BLOCKS GST_FFMPEG_URL_DEFAULT_BLOCKS
+
+/* when the header already gave us all codec parameters, av_find_stream_info
+ * only needs to see the first packet of each stream. Don't let it read the
+ * full probe size looking for a sparse stream in that case. */
+#define COMPLETE_HEADER_PROBE_SIZE (256 * 1024)
+
+/* version of the on-disk index cache format */
+#define INDEX_CACHE_MAGIC "GFIX"
+#define INDEX_CACHE_VERSION 1
+
 typedef struct _GstFFMpegDemuxClass GstFFMpegDemuxClass;
 
 struct _GstFFMpegDemuxClass
@@ -118,6 +184,10 @@ static void gst_ffmpegdemux_class_init (GstFFMpegDemuxClass * klass);
 static void gst_ffmpegdemux_base_init (GstFFMpegDemuxClass * klass);
 static void gst_ffmpegdemux_init (GstFFMpegDemux * demux);
 static void gst_ffmpegdemux_finalize (GObject * object);
+static void gst_ffmpegdemux_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_ffmpegdemux_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static gboolean gst_ffmpegdemux_sink_event (GstPad * sinkpad, GstEvent * event);
 static GstFlowReturn gst_ffmpegdemux_chain (GstPad * sinkpad, GstBuffer * buf);
@@ -184,7 +254,7 @@ gst_ffmpegdemux_base_init (GstFFMpegDemuxClass * klass)
   gchar *p, *name;
   GstCaps *sinkcaps;
   GstPadTemplate *sinktempl, *audiosrctempl, *videosrctempl;
-  gchar *longname, *description;
+  gchar *longname, *description, *key;
 
   in_plugin = (AVInputFormat *)
       g_type_get_qdata (G_OBJECT_CLASS_TYPE (klass), GST_FFDEMUX_PARAMS_QDATA);
@@ -209,7 +279,12 @@ gst_ffmpegdemux_base_init (GstFFMpegDemuxClass * klass)
   g_free (description);
 
   /* pad templates */
-  sinkcaps = gst_ffmpeg_formatid_to_caps (name);
+  key = g_strdup_printf ("ffdemux-%s-sink", name);
+  if (!gst_ffmpeg_caps_cache_get (key, &sinkcaps)) {
+    sinkcaps = gst_ffmpeg_formatid_to_caps (name);
+    gst_ffmpeg_caps_cache_put (key, sinkcaps);
+  }
+  g_free (key);
   sinktempl = gst_pad_template_new ("sink",
       GST_PAD_SINK, GST_PAD_ALWAYS, sinkcaps);
   videosrctempl = gst_pad_template_new ("video_%02d",
@@ -239,6 +314,63 @@ gst_ffmpegdemux_class_init (GstFFMpegDemuxClass * klass)
   parent_class = g_type_class_peek_parent (klass);
 
   gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_ffmpegdemux_finalize);
+  gobject_class->set_property = gst_ffmpegdemux_set_property;
+  gobject_class->get_property = gst_ffmpegdemux_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_INDEX_CACHE,
+      g_param_spec_boolean ("index-cache", "Index cache",
+          "Keep the seek index of local files in the user cache directory "
+          "and reuse it the next time the file is opened",
+          DEFAULT_INDEX_CACHE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PROBE_SIZE,
+      g_param_spec_uint ("probe-size", "Probe size",
+          "Maximum number of bytes to read when probing the streams "
+          "(0 = ffmpeg default)",
+          0, G_MAXUINT, DEFAULT_PROBE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ANALYZE_DURATION,
+      g_param_spec_uint64 ("analyze-duration", "Analyze duration",
+          "Maximum amount of stream time to analyze when probing the "
+          "streams in nanoseconds (0 = ffmpeg default)",
+          0, G_MAXUINT64, DEFAULT_ANALYZE_DURATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STREAM_QUEUES,
+      g_param_spec_boolean ("stream-queues", "Stream queues",
+          "Push each stream from its own thread through a bounded queue so "
+          "that a slow stream does not block the others (only takes effect "
+          "for pads created afterwards)",
+          DEFAULT_STREAM_QUEUES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_QUEUE_MAX_BYTES,
+      g_param_spec_uint ("queue-max-bytes", "Queue max bytes",
+          "Maximum number of bytes in each stream queue (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_QUEUE_MAX_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_QUEUE_MAX_TIME,
+      g_param_spec_uint64 ("queue-max-time", "Queue max time",
+          "Maximum amount of data in each stream queue in nanoseconds "
+          "(0 = unlimited)",
+          0, G_MAXUINT64, DEFAULT_QUEUE_MAX_TIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CACHE_BLOCK_SIZE,
+      g_param_spec_uint ("cache-block-size", "Cache block size",
+          "Size of the blocks pulled from upstream in pull mode "
+          "(0 = no read-ahead cache, takes effect on the next open)",
+          0, G_MAXUINT, DEFAULT_CACHE_BLOCK_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CACHE_BLOCKS,
+      g_param_spec_uint ("cache-blocks", "Cache blocks",
+          "Number of blocks kept in the read-ahead cache in pull mode "
+          "(0 = no read-ahead cache, takes effect on the next open)",
+          0, G_MAXUINT, DEFAULT_CACHE_BLOCKS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CACHE_HITS,
+      g_param_spec_uint64 ("cache-hits", "Cache hits",
+          "Number of reads served from the read-ahead cache",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CACHE_MISSES,
+      g_param_spec_uint64 ("cache-misses", "Cache misses",
+          "Number of reads that had to be pulled from upstream",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
   gstelement_class->change_state = gst_ffmpegdemux_change_state;
   gstelement_class->send_event = gst_ffmpegdemux_send_event;
@@ -288,12 +420,23 @@ gst_ffmpegdemux_init (GstFFMpegDemux * demux)
   demux->ffpipe.tlock = g_mutex_new ();
   demux->ffpipe.cond = g_cond_new ();
   demux->ffpipe.adapter = gst_adapter_new ();
+  demux->ffpipe.high_watermark = GST_FFMPEG_PIPE_HIGH_WATERMARK;
+  demux->ffpipe.low_watermark = GST_FFMPEG_PIPE_LOW_WATERMARK;
 
   /* blacklist unreliable push-based demuxers */
   if (strcmp (oclass->in_plugin->name, "ape"))
     demux->can_push = TRUE;
   else
     demux->can_push = FALSE;
+
+  demux->index_cache = DEFAULT_INDEX_CACHE;
+  demux->probe_size = DEFAULT_PROBE_SIZE;
+  demux->analyze_duration = DEFAULT_ANALYZE_DURATION;
+  demux->stream_queues = DEFAULT_STREAM_QUEUES;
+  demux->queue_max_bytes = DEFAULT_QUEUE_MAX_BYTES;
+  demux->queue_max_time = DEFAULT_QUEUE_MAX_TIME;
+  demux->cache_block_size = DEFAULT_CACHE_BLOCK_SIZE;
+  demux->cache_blocks = DEFAULT_CACHE_BLOCKS;
 }
 
 static void
@@ -311,9 +454,536 @@ gst_ffmpegdemux_finalize (GObject * object)
   g_static_rec_mutex_free (demux->task_lock);
   g_free (demux->task_lock);
 
+  g_free (demux->index_cache_file);
+  g_free (demux->index_cache_key);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_ffmpegdemux_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFFMpegDemux *demux = (GstFFMpegDemux *) object;
+
+  switch (prop_id) {
+    case PROP_INDEX_CACHE:
+      demux->index_cache = g_value_get_boolean (value);
+      break;
+    case PROP_PROBE_SIZE:
+      demux->probe_size = g_value_get_uint (value);
+      break;
+    case PROP_ANALYZE_DURATION:
+      demux->analyze_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_STREAM_QUEUES:
+      demux->stream_queues = g_value_get_boolean (value);
+      break;
+    case PROP_QUEUE_MAX_BYTES:
+      demux->queue_max_bytes = g_value_get_uint (value);
+      break;
+    case PROP_QUEUE_MAX_TIME:
+      demux->queue_max_time = g_value_get_uint64 (value);
+      break;
+    case PROP_CACHE_BLOCK_SIZE:
+      demux->cache_block_size = g_value_get_uint (value);
+      break;
+    case PROP_CACHE_BLOCKS:
+      demux->cache_blocks = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ffmpegdemux_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstFFMpegDemux *demux = (GstFFMpegDemux *) object;
+
+  switch (prop_id) {
+    case PROP_INDEX_CACHE:
+      g_value_set_boolean (value, demux->index_cache);
+      break;
+    case PROP_PROBE_SIZE:
+      g_value_set_uint (value, demux->probe_size);
+      break;
+    case PROP_ANALYZE_DURATION:
+      g_value_set_uint64 (value, demux->analyze_duration);
+      break;
+    case PROP_STREAM_QUEUES:
+      g_value_set_boolean (value, demux->stream_queues);
+      break;
+    case PROP_QUEUE_MAX_BYTES:
+      g_value_set_uint (value, demux->queue_max_bytes);
+      break;
+    case PROP_QUEUE_MAX_TIME:
+      g_value_set_uint64 (value, demux->queue_max_time);
+      break;
+    case PROP_CACHE_BLOCK_SIZE:
+      g_value_set_uint (value, demux->cache_block_size);
+      break;
+    case PROP_CACHE_BLOCKS:
+      g_value_set_uint (value, demux->cache_blocks);
+      break;
+    case PROP_CACHE_HITS:
+      GST_OBJECT_LOCK (demux);
+      g_value_set_uint64 (value, demux->cache_hits);
+      GST_OBJECT_UNLOCK (demux);
+      break;
+    case PROP_CACHE_MISSES:
+      GST_OBJECT_LOCK (demux);
+      g_value_set_uint64 (value, demux->cache_misses);
+      GST_OBJECT_UNLOCK (demux);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Seek index cache.
+ *
+ * The index entries of all streams are stored in a file in the user cache
+ * directory. The file is named after a hash of the key, the key itself is
+ * stored in the file as well. The key is made of the uri, size and mtime of
+ * the file so that we don't use an index of a modified file. All values are
+ * little endian.
+ *
+ *  "GFIX" | version (u32) | key length (u32) | key | index_built (u32) |
+ *  nb_streams (u32) | for each stream: nb_entries (u32) |
+ *    for each entry: pos (i64) | timestamp (i64) | flags (u32) | size (u32) |
+ *    min_distance (u32)
+ */
+static void
+gst_ffmpegdemux_index_cache_setup (GstFFMpegDemux * demux)
+{
+  GstQuery *query;
+  gchar *uri = NULL, *filename = NULL, *name;
+  struct stat st;
+
+  g_free (demux->index_cache_file);
+  demux->index_cache_file = NULL;
+  g_free (demux->index_cache_key);
+  demux->index_cache_key = NULL;
+  demux->index_cache_entries = 0;
+
+  if (!demux->index_cache || !demux->seekable)
+    return;
+
+  query = gst_query_new_uri ();
+  if (gst_pad_peer_query (demux->sinkpad, query))
+    gst_query_parse_uri (query, &uri);
+  gst_query_unref (query);
+
+  /* we can only check local files for modifications */
+  if (uri == NULL || (filename = g_filename_from_uri (uri, NULL, NULL)) == NULL)
+    goto no_file;
+
+  if (g_stat (filename, &st) != 0)
+    goto no_file;
+
+  demux->index_cache_key = g_strdup_printf ("%s:%" G_GINT64_FORMAT ":%"
+      G_GINT64_FORMAT, uri, (gint64) st.st_size, (gint64) st.st_mtime);
+  name = g_strdup_printf ("%08x.idx", g_str_hash (demux->index_cache_key));
+  demux->index_cache_file = g_build_filename (g_get_user_cache_dir (),
+      "gst-ffmpeg", "index", name, NULL);
+  g_free (name);
+
+  GST_DEBUG_OBJECT (demux, "index cache %s for %s", demux->index_cache_file,
+      demux->index_cache_key);
+
+  g_free (filename);
+  g_free (uri);
+  return;
+
+no_file:
+  {
+    GST_DEBUG_OBJECT (demux, "no local file, not caching the index");
+    g_free (filename);
+    g_free (uri);
+    return;
+  }
+}
+
+#define INDEX_CACHE_READ_U32(val) G_STMT_START {        \
+  if (end - data < 4)                                   \
+    goto invalid;                                       \
+  val = GST_READ_UINT32_LE (data);                      \
+  data += 4;                                            \
+} G_STMT_END
+
+#define INDEX_CACHE_READ_I64(val) G_STMT_START {        \
+  if (end - data < 8)                                   \
+    goto invalid;                                       \
+  val = (gint64) GST_READ_UINT64_LE (data);             \
+  data += 8;                                            \
+} G_STMT_END
+
+static void
+gst_ffmpegdemux_index_cache_load (GstFFMpegDemux * demux)
+{
+  gchar *contents;
+  gsize length;
+  const guint8 *data, *end;
+  guint32 version, key_len, index_built, nb_streams, nb_entries, i, j;
+
+  if (demux->index_cache_file == NULL)
+    return;
+
+  if (!g_file_get_contents (demux->index_cache_file, &contents, &length, NULL))
+    return;
+
+  data = (const guint8 *) contents;
+  end = data + length;
+
+  if (length < 4 || memcmp (data, INDEX_CACHE_MAGIC, 4) != 0)
+    goto invalid;
+  data += 4;
+
+  INDEX_CACHE_READ_U32 (version);
+  if (version != INDEX_CACHE_VERSION)
+    goto invalid;
+
+  INDEX_CACHE_READ_U32 (key_len);
+  if ((gsize) (end - data) < key_len ||
+      key_len != strlen (demux->index_cache_key) ||
+      memcmp (data, demux->index_cache_key, key_len) != 0)
+    goto invalid;
+  data += key_len;
+
+  INDEX_CACHE_READ_U32 (index_built);
+  INDEX_CACHE_READ_U32 (nb_streams);
+  if (nb_streams != demux->context->nb_streams)
+    goto invalid;
+
+  for (i = 0; i < nb_streams; i++) {
+    AVStream *avstream = demux->context->streams[i];
+
+    INDEX_CACHE_READ_U32 (nb_entries);
+    for (j = 0; j < nb_entries; j++) {
+      gint64 pos, timestamp;
+      guint32 flags, size, min_distance;
+
+      INDEX_CACHE_READ_I64 (pos);
+      INDEX_CACHE_READ_I64 (timestamp);
+      INDEX_CACHE_READ_U32 (flags);
+      INDEX_CACHE_READ_U32 (size);
+      INDEX_CACHE_READ_U32 (min_distance);
+
+      av_add_index_entry (avstream, pos, timestamp, size, min_distance, flags);
+    }
+    demux->index_cache_entries += avstream->nb_index_entries;
+  }
+
+  if (index_built)
+    demux->context->index_built = 1;
+
+  GST_DEBUG_OBJECT (demux, "restored %u index entries",
+      demux->index_cache_entries);
+
+  g_free (contents);
+  return;
+
+invalid:
+  {
+    GST_DEBUG_OBJECT (demux, "ignoring invalid index cache");
+    g_free (contents);
+    return;
+  }
+}
+
+#undef INDEX_CACHE_READ_U32
+#undef INDEX_CACHE_READ_I64
+
+static void
+index_cache_write_u32 (GByteArray * array, guint32 val)
+{
+  val = GUINT32_TO_LE (val);
+  g_byte_array_append (array, (const guint8 *) &val, 4);
+}
+
+static void
+index_cache_write_i64 (GByteArray * array, gint64 val)
+{
+  val = GINT64_TO_LE (val);
+  g_byte_array_append (array, (const guint8 *) &val, 8);
+}
+
+static void
+gst_ffmpegdemux_index_cache_save (GstFFMpegDemux * demux)
+{
+  GByteArray *array;
+  gchar *dirname;
+  guint i, total = 0;
+  gint j;
+
+  if (demux->index_cache_file == NULL)
+    return;
+
+  for (i = 0; i < demux->context->nb_streams; i++)
+    total += demux->context->streams[i]->nb_index_entries;
+
+  /* nothing new since we loaded it */
+  if (total <= demux->index_cache_entries)
+    return;
+
+  array = g_byte_array_new ();
+  g_byte_array_append (array, (const guint8 *) INDEX_CACHE_MAGIC, 4);
+  index_cache_write_u32 (array, INDEX_CACHE_VERSION);
+  index_cache_write_u32 (array, strlen (demux->index_cache_key));
+  g_byte_array_append (array, (const guint8 *) demux->index_cache_key,
+      strlen (demux->index_cache_key));
+  index_cache_write_u32 (array, demux->context->index_built);
+  index_cache_write_u32 (array, demux->context->nb_streams);
+
+  for (i = 0; i < demux->context->nb_streams; i++) {
+    AVStream *avstream = demux->context->streams[i];
+
+    index_cache_write_u32 (array, avstream->nb_index_entries);
+    for (j = 0; j < avstream->nb_index_entries; j++) {
+      AVIndexEntry *entry = &avstream->index_entries[j];
+
+      index_cache_write_i64 (array, entry->pos);
+      index_cache_write_i64 (array, entry->timestamp);
+      index_cache_write_u32 (array, entry->flags);
+      index_cache_write_u32 (array, entry->size);
+      index_cache_write_u32 (array, entry->min_distance);
+    }
+  }
+
+  dirname = g_path_get_dirname (demux->index_cache_file);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (g_file_set_contents (demux->index_cache_file, (const gchar *) array->data,
+          array->len, NULL)) {
+    GST_DEBUG_OBJECT (demux, "stored %u index entries in %s", total,
+        demux->index_cache_file);
+  } else {
+    GST_WARNING_OBJECT (demux, "could not write index cache %s",
+        demux->index_cache_file);
+  }
+  g_byte_array_free (array, TRUE);
+}
+
+/* Stream queues.
+ *
+ * With stream-queues enabled every source pad gets a queue and a task that
+ * pushes the queued buffers and serialized events downstream. The demux
+ * task only reads packets and blocks when the queue of the stream it wants
+ * to add to is full. The flow returns of the push tasks are collected in
+ * last_flow and handled by the demux task as before.
+ */
+static gboolean
+gst_ffmpegdemux_stream_queue_is_full (GstFFStream * stream)
+{
+  GstFFMpegDemux *demux = stream->demux;
+
+  /* always allow one item so that big buffers can pass */
+  if (g_queue_is_empty (stream->queue))
+    return FALSE;
+
+  if (demux->queue_max_bytes &&
+      stream->queued_bytes >= demux->queue_max_bytes)
+    return TRUE;
+
+  if (demux->queue_max_time &&
+      GST_CLOCK_TIME_IS_VALID (stream->queue_in_ts) &&
+      GST_CLOCK_TIME_IS_VALID (stream->queue_out_ts) &&
+      stream->queue_in_ts > stream->queue_out_ts &&
+      stream->queue_in_ts - stream->queue_out_ts >= demux->queue_max_time)
+    return TRUE;
+
+  return FALSE;
+}
+
+/* must be called with the qlock */
+static void
+gst_ffmpegdemux_stream_queue_clear (GstFFStream * stream)
+{
+  GstMiniObject *obj;
+
+  while ((obj = g_queue_pop_head (stream->queue)))
+    gst_mini_object_unref (obj);
+  stream->queued_bytes = 0;
+  stream->queue_in_ts = GST_CLOCK_TIME_NONE;
+  stream->queue_out_ts = GST_CLOCK_TIME_NONE;
+}
+
+/* takes ownership of @obj, returns the last flow return of the push task */
+static GstFlowReturn
+gst_ffmpegdemux_stream_queue_push (GstFFStream * stream, GstMiniObject * obj)
+{
+  GstFlowReturn ret;
+
+  g_mutex_lock (stream->qlock);
+  while (!stream->qflushing && gst_ffmpegdemux_stream_queue_is_full (stream)) {
+    GST_LOG_OBJECT (stream->pad, "queue full (%u bytes), waiting",
+        stream->queued_bytes);
+    g_cond_wait (stream->qcond, stream->qlock);
+  }
+
+  if (stream->qflushing)
+    goto flushing;
+
+  if (GST_IS_BUFFER (obj)) {
+    GstBuffer *buf = GST_BUFFER_CAST (obj);
+
+    stream->queued_bytes += GST_BUFFER_SIZE (buf);
+    if (GST_BUFFER_TIMESTAMP_IS_VALID (buf)) {
+      stream->queue_in_ts = GST_BUFFER_TIMESTAMP (buf);
+      if (!GST_CLOCK_TIME_IS_VALID (stream->queue_out_ts))
+        stream->queue_out_ts = stream->queue_in_ts;
+    }
+  }
+  g_queue_push_tail (stream->queue, obj);
+  g_cond_signal (stream->qcond);
+  ret = stream->last_flow;
+  g_mutex_unlock (stream->qlock);
+
+  return ret;
+
+flushing:
+  {
+    GST_DEBUG_OBJECT (stream->pad, "flushing, dropping %" GST_PTR_FORMAT, obj);
+    stream->last_flow = GST_FLOW_WRONG_STATE;
+    g_mutex_unlock (stream->qlock);
+    gst_mini_object_unref (obj);
+    return GST_FLOW_WRONG_STATE;
+  }
+}
+
+static void
+gst_ffmpegdemux_stream_loop (GstFFStream * stream)
+{
+  GstMiniObject *obj;
+  GstFlowReturn ret;
+
+  g_mutex_lock (stream->qlock);
+  while (!stream->qflushing && g_queue_is_empty (stream->queue))
+    g_cond_wait (stream->qcond, stream->qlock);
+
+  if (stream->qflushing)
+    goto flushing;
+
+  obj = g_queue_pop_head (stream->queue);
+  if (GST_IS_BUFFER (obj)) {
+    GstBuffer *buf = GST_BUFFER_CAST (obj);
+
+    stream->queued_bytes -= GST_BUFFER_SIZE (buf);
+    if (GST_BUFFER_TIMESTAMP_IS_VALID (buf))
+      stream->queue_out_ts = GST_BUFFER_TIMESTAMP (buf);
+  }
+  /* wake up the demux task if it waits for space */
+  g_cond_signal (stream->qcond);
+  g_mutex_unlock (stream->qlock);
+
+  if (GST_IS_BUFFER (obj)) {
+    ret = gst_pad_push (stream->pad, GST_BUFFER_CAST (obj));
+
+    g_mutex_lock (stream->qlock);
+    /* the flow return of a flushed push is meaningless after the flush */
+    if (!stream->qflushing)
+      stream->last_flow = ret;
+    g_mutex_unlock (stream->qlock);
+  } else {
+    gst_pad_push_event (stream->pad, GST_EVENT_CAST (obj));
+  }
+
+  return;
+
+flushing:
+  {
+    GST_DEBUG_OBJECT (stream->pad, "flushing, pausing task");
+    g_mutex_unlock (stream->qlock);
+    gst_pad_pause_task (stream->pad);
+    return;
+  }
+}
+
+static void
+gst_ffmpegdemux_stream_queue_set_flushing (GstFFStream * stream,
+    gboolean flushing)
+{
+  g_mutex_lock (stream->qlock);
+  stream->qflushing = flushing;
+  gst_ffmpegdemux_stream_queue_clear (stream);
+  if (!flushing)
+    stream->last_flow = GST_FLOW_OK;
+  g_cond_broadcast (stream->qcond);
+  g_mutex_unlock (stream->qlock);
+}
+
+static gboolean
+gst_ffmpegdemux_src_activate_push (GstPad * pad, gboolean active)
+{
+  GstFFStream *stream = gst_pad_get_element_private (pad);
+
+  if (active) {
+    gst_ffmpegdemux_stream_queue_set_flushing (stream, FALSE);
+    return gst_pad_start_task (pad,
+        (GstTaskFunction) gst_ffmpegdemux_stream_loop, stream);
+  }
+
+  /* unblock both tasks, then wait for the push task to stop */
+  gst_ffmpegdemux_stream_queue_set_flushing (stream, TRUE);
+  return gst_pad_stop_task (pad);
+}
+
+/* called after pushing flush-start and flush-stop downstream */
+static void
+gst_ffmpegdemux_flush_queues (GstFFMpegDemux * demux, gboolean flushing)
+{
+  gint n;
+
+  for (n = 0; n < MAX_STREAMS; n++) {
+    GstFFStream *s = demux->streams[n];
+
+    if (!s || !s->queue)
+      continue;
+
+    if (flushing) {
+      gst_ffmpegdemux_stream_queue_set_flushing (s, TRUE);
+      /* wait for the push task to leave the current iteration */
+      gst_pad_pause_task (s->pad);
+    } else {
+      gst_ffmpegdemux_stream_queue_set_flushing (s, FALSE);
+      gst_pad_start_task (s->pad,
+          (GstTaskFunction) gst_ffmpegdemux_stream_loop, s);
+    }
+  }
+}
+
+static void
+gst_ffmpegdemux_stream_queue_free (GstFFStream * stream)
+{
+  gst_ffmpegdemux_stream_queue_clear (stream);
+  g_queue_free (stream->queue);
+  g_mutex_free (stream->qlock);
+  g_cond_free (stream->qcond);
+  stream->queue = NULL;
+}
+
+/* copy the read-ahead cache statistics of the protocol for the properties,
+ * must be called from the thread that reads from the context */
+static void
+gst_ffmpegdemux_update_cache_stats (GstFFMpegDemux * demux)
+{
+  guint64 hits, misses;
+
+  if (demux->context == NULL || demux->context->pb == NULL ||
+      !gst_ffmpeg_url_get_cache_stats (demux->context->pb, &hits, &misses))
+    return;
+
+  GST_OBJECT_LOCK (demux);
+  demux->cache_hits = hits;
+  demux->cache_misses = misses;
+  GST_OBJECT_UNLOCK (demux);
+}
+
 static void
 gst_ffmpegdemux_close (GstFFMpegDemux * demux)
 {
@@ -329,10 +999,16 @@ gst_ffmpegdemux_close (GstFFMpegDemux * demux)
 
     stream = demux->streams[n];
     if (stream) {
-      if (stream->pad)
+      if (stream->pad) {
+        /* stops the push task of the queue */
+        if (stream->queue)
+          gst_pad_set_active (stream->pad, FALSE);
         gst_element_remove_pad (GST_ELEMENT (demux), stream->pad);
+      }
       if (stream->tags)
         gst_tag_list_free (stream->tags);
+      if (stream->queue)
+        gst_ffmpegdemux_stream_queue_free (stream);
       g_free (stream);
     }
     demux->streams[n] = NULL;
@@ -340,6 +1016,9 @@ gst_ffmpegdemux_close (GstFFMpegDemux * demux)
   demux->videopads = 0;
   demux->audiopads = 0;
 
+  gst_ffmpegdemux_index_cache_save (demux);
+  gst_ffmpegdemux_update_cache_stats (demux);
+
   /* close demuxer context from ffmpeg */
   av_close_input_file (demux->context);
   demux->context = NULL;
@@ -371,7 +1050,14 @@ gst_ffmpegdemux_push_event (GstFFMpegDemux * demux, GstEvent * event)
 
     if (s && s->pad) {
       gst_event_ref (event);
-      res &= gst_pad_push_event (s->pad, event);
+      /* serialized events have to stay in order with the queued data,
+       * flush-stop is sent while the queue is still flushing and has to go
+       * out directly */
+      if (s->queue && GST_EVENT_IS_SERIALIZED (event) &&
+          GST_EVENT_TYPE (event) != GST_EVENT_FLUSH_STOP)
+        gst_ffmpegdemux_stream_queue_push (s, GST_MINI_OBJECT_CAST (event));
+      else
+        res &= gst_pad_push_event (s->pad, event);
     }
   }
   gst_event_unref (event);
@@ -561,6 +1247,7 @@ gst_ffmpegdemux_perform_seek (GstFFMpegDemux * demux, GstEvent * event)
     GST_OBJECT_UNLOCK (demux);
     gst_pad_push_event (demux->sinkpad, gst_event_new_flush_start ());
     gst_ffmpegdemux_push_event (demux, gst_event_new_flush_start ());
+    gst_ffmpegdemux_flush_queues (demux, TRUE);
   } else {
     gst_pad_pause_task (demux->sinkpad);
   }
@@ -607,6 +1294,7 @@ gst_ffmpegdemux_perform_seek (GstFFMpegDemux * demux, GstEvent * event)
       if (demux->streams[n])
         demux->streams[n]->last_flow = GST_FLOW_OK;
     }
+    gst_ffmpegdemux_flush_queues (demux, FALSE);
   } else if (res && demux->running) {
     /* we are running the current segment and doing a non-flushing seek,
      * close the segment first based on the last_stop. */
@@ -1018,6 +1706,17 @@ gst_ffmpegdemux_get_stream (GstFFMpegDemux * demux, AVStream * avstream)
   stream->pad = pad;
   gst_pad_set_element_private (pad, stream);
 
+  /* the push task of the queue is started when the pad is activated */
+  if (demux->stream_queues) {
+    stream->demux = demux;
+    stream->queue = g_queue_new ();
+    stream->qlock = g_mutex_new ();
+    stream->qcond = g_cond_new ();
+    stream->qflushing = TRUE;
+    gst_pad_set_activatepush_function (pad,
+        GST_DEBUG_FUNCPTR (gst_ffmpegdemux_src_activate_push));
+  }
+
   /* transform some useful info to GstClockTime and remember */
   {
     GstClockTime tmp;
@@ -1138,6 +1837,61 @@ gst_ffmpegdemux_read_tags (GstFFMpegDemux * demux)
   return tlist;
 }
 
+/* check if the header gave us everything we need to configure a decoder
+ * for this stream. This is what av_find_stream_info would otherwise try
+ * to find by decoding. */
+static gboolean
+gst_ffmpegdemux_has_codec_parameters (AVCodecContext * ctx)
+{
+  if (ctx->codec_id == CODEC_ID_NONE)
+    return FALSE;
+
+  switch (ctx->codec_type) {
+    case CODEC_TYPE_AUDIO:
+      return ctx->sample_rate > 0 && ctx->channels > 0 &&
+          ctx->sample_fmt != SAMPLE_FMT_NONE;
+    case CODEC_TYPE_VIDEO:
+      return ctx->width > 0 && ctx->height > 0 &&
+          ctx->pix_fmt != PIX_FMT_NONE;
+    default:
+      return TRUE;
+  }
+}
+
+static void
+gst_ffmpegdemux_setup_probe (GstFFMpegDemux * demux)
+{
+  AVFormatContext *ic = demux->context;
+  gboolean complete = TRUE;
+  guint i;
+
+  if (demux->probe_size > 0)
+    ic->probesize = demux->probe_size;
+  if (demux->analyze_duration > 0)
+    ic->max_analyze_duration =
+        MIN (gst_util_uint64_scale (demux->analyze_duration, AV_TIME_BASE,
+            GST_SECOND), G_MAXINT);
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    if (!gst_ffmpegdemux_has_codec_parameters (ic->streams[i]->codec)) {
+      complete = FALSE;
+      break;
+    }
+  }
+
+  /* no streams yet means the demuxer creates them while reading packets. An
+   * explicitly configured probe size is always respected. */
+  if (ic->nb_streams > 0 && complete && demux->probe_size == 0 &&
+      ic->probesize > COMPLETE_HEADER_PROBE_SIZE) {
+    GST_DEBUG_OBJECT (demux, "header has all codec parameters, limiting "
+        "probe size to %d", COMPLETE_HEADER_PROBE_SIZE);
+    ic->probesize = COMPLETE_HEADER_PROBE_SIZE;
+  }
+
+  GST_DEBUG_OBJECT (demux, "probing %u bytes, %d us", ic->probesize,
+      ic->max_analyze_duration);
+}
+
 static gboolean
 gst_ffmpegdemux_open (GstFFMpegDemux * demux)
 {
@@ -1152,9 +1906,15 @@ gst_ffmpegdemux_open (GstFFMpegDemux * demux)
   /* to be sure... */
   gst_ffmpegdemux_close (demux);
 
+  GST_OBJECT_LOCK (demux);
+  demux->cache_hits = 0;
+  demux->cache_misses = 0;
+  GST_OBJECT_UNLOCK (demux);
+
   /* open via our input protocol hack */
   if (demux->seekable)
-    location = g_strdup_printf ("gstreamer://%p", demux->sinkpad);
+    location = g_strdup_printf ("gstreamer://%p?blocksize=%u&blocks=%u",
+        demux->sinkpad, demux->cache_block_size, demux->cache_blocks);
   else
     location = g_strdup_printf ("gstpipe://%p", &demux->ffpipe);
   GST_DEBUG_OBJECT (demux, "about to call av_open_input_file %s", location);
@@ -1167,11 +1927,16 @@ gst_ffmpegdemux_open (GstFFMpegDemux * demux)
   if (res < 0)
     goto open_failed;
 
+  gst_ffmpegdemux_setup_probe (demux);
+
   res = gst_ffmpeg_av_find_stream_info (demux->context);
   GST_DEBUG_OBJECT (demux, "av_find_stream_info returned %d", res);
   if (res < 0)
     goto no_info;
 
+  gst_ffmpegdemux_index_cache_setup (demux);
+  gst_ffmpegdemux_index_cache_load (demux);
+
   n_streams = demux->context->nb_streams;
   GST_DEBUG_OBJECT (demux, "we have %d streams", n_streams);
 
@@ -1266,13 +2031,111 @@ no_info:
 #define GST_FFMPEG_TYPE_FIND_SIZE 4096
 #define GST_FFMPEG_TYPE_FIND_MIN_SIZE 256
 
+/* All ffmpeg formats are typefound by one typefind function. Formats that
+ * always start with a fixed signature are listed here, their read_probe is
+ * only called when the signature matches. They are tried before the formats
+ * that are not listed, which are always probed, so that a certain match
+ * skips the expensive scans of those. A format can be listed more than once
+ * when it has several signatures, its entries have to be next to each
+ * other. */
+typedef struct
+{
+  const gchar *name;
+  guint offset;
+  const gchar *magic;
+  guint len;
+} GstFFMpegTypeFindMagic;
+
+static const GstFFMpegTypeFindMagic typefind_magic[] = {
+  {"4xm", 0, "RIFF", 4},
+  {"amr", 0, "#!AMR", 5},
+  {"apc", 0, "CRYO_APC", 8},
+  /* avi_probe checks the RIFF and ON2 chunk ids at offset 0 */
+  {"avi", 8, "AVI ", 4},
+  {"avi", 8, "AVIX", 4},
+  {"avi", 8, "AVI\x19", 4},
+  {"avi", 8, "AMV ", 4},
+  {"avi", 0, "ON2 ", 4},
+  {"bfi", 0, "BF&I", 4},
+  {"dxa", 0, "DEXA", 4},
+  {"ffm", 0, "FFM1", 4},
+  {"film_cpk", 0, "FILM", 4},
+  {"gxf", 0, "\0\0\0\0\1\274", 6},
+  {"IFF", 0, "FORM", 4},
+  {"ISS", 0, "IMA_ADPCM_Sound", 15},
+  {"mmf", 0, "MMMD", 4},
+  {"MTV", 0, "AMV", 3},
+  {"oma", 0, "ea3", 3},
+  {"oma", 0, "EA3", 3},
+  {"qcp", 0, "RIFF", 4},
+  {"r3d", 4, "RED1", 4},
+  {"rl2", 0, "FORM", 4},
+  {"rpl", 0, "ARMovie\n", 8},
+  {"siff", 0, "SIFF", 4},
+  {"smk", 0, "SMK", 3},
+  {"sol", 2, "SOL\0", 4},
+  {"sox", 0, ".SoX", 4},
+  {"sox", 0, "XoS.", 4},
+  {"thp", 0, "THP\0", 4},
+  {"tmv", 0, "TMAV", 4},
+  {"vqf", 0, "TWIN", 4},
+  {"wc3movie", 0, "FORM", 4},
+  {"xa", 0, "XA", 2},
+  {"yop", 0, "YO", 2},
+  {"yuv4mpegpipe", 0, "YUV4MPEG2", 9},
+  {NULL, 0, NULL, 0}
+};
+
+typedef struct
+{
+  AVInputFormat *in_plugin;
+  /* first entry in typefind_magic for this format or NULL */
+  const GstFFMpegTypeFindMagic *magic;
+
+  /* probe stats, protected by typefind_lock */
+  guint64 n_probes;
+  GstClockTime probe_time;
+} GstFFMpegTypeFinder;
+
+static GStaticMutex typefind_lock = G_STATIC_MUTEX_INIT;
+
+static const GstFFMpegTypeFindMagic *
+gst_ffmpegdemux_type_find_get_magic (const gchar * name)
+{
+  const GstFFMpegTypeFindMagic *magic;
+
+  for (magic = typefind_magic; magic->name; magic++) {
+    if (!strcmp (magic->name, name))
+      return magic;
+  }
+  return NULL;
+}
+
+static gboolean
+gst_ffmpegdemux_type_find_match (const GstFFMpegTypeFindMagic * magic,
+    const guint8 * data, guint64 length)
+{
+  const gchar *name = magic->name;
+
+  /* entries of one format are next to each other */
+  for (; magic->name && !strcmp (magic->name, name); magic++) {
+    if (magic->offset + magic->len <= length &&
+        !memcmp (data + magic->offset, magic->magic, magic->len))
+      return TRUE;
+  }
+  return FALSE;
+}
+
 static void
 gst_ffmpegdemux_type_find (GstTypeFind * tf, gpointer priv)
 {
+  GPtrArray *finders = (GPtrArray *) priv;
+  GstFFMpegTypeFinder *best = NULL;
   guint8 *data;
-  AVInputFormat *in_plugin = (AVInputFormat *) priv;
-  gint res = 0;
+  gint res, best_res = 0;
   guint64 length;
+  guint i, n_probed = 0;
+  GstClockTime start, stop, total;
   GstCaps *sinkcaps;
 
   /* We want GST_FFMPEG_TYPE_FIND_SIZE bytes, but if the file is shorter than
@@ -1290,32 +2153,70 @@ gst_ffmpegdemux_type_find (GstTypeFind * tf, gpointer priv)
     return;
   }
 
+  if ((data = gst_type_find_peek (tf, 0, length)) == NULL)
+    return;
+
   GST_LOG ("typefinding %" G_GUINT64_FORMAT " bytes", length);
-  if (in_plugin->read_probe &&
-      (data = gst_type_find_peek (tf, 0, length)) != NULL) {
+  total = gst_util_get_timestamp ();
+
+  for (i = 0; i < finders->len; i++) {
+    GstFFMpegTypeFinder *finder = g_ptr_array_index (finders, i);
+    AVInputFormat *in_plugin = finder->in_plugin;
     AVProbeData probe_data;
 
+    if (finder->magic &&
+        !gst_ffmpegdemux_type_find_match (finder->magic, data, length))
+      continue;
+
     probe_data.filename = "";
     probe_data.buf = data;
     probe_data.buf_size = length;
 
+    start = gst_util_get_timestamp ();
     res = in_plugin->read_probe (&probe_data);
-    if (res > 0) {
-      res = MAX (1, res * GST_TYPE_FIND_MAXIMUM / AVPROBE_SCORE_MAX);
-      /* Restrict the probability for MPEG-TS streams, because there is
-       * probably a better version in plugins-base, if the user has a recent
-       * plugins-base (in fact we shouldn't even get here for ffmpeg mpegts or
-       * mpegtsraw typefinders, since we blacklist them) */
-      if (g_str_has_prefix (in_plugin->name, "mpegts"))
-        res = MIN (res, GST_TYPE_FIND_POSSIBLE);
+    stop = gst_util_get_timestamp ();
+    n_probed++;
+
+    g_static_mutex_lock (&typefind_lock);
+    finder->n_probes++;
+    finder->probe_time += stop - start;
+    GST_LOG ("probed '%s' in %" GST_TIME_FORMAT ", %" G_GUINT64_FORMAT
+        " probes in %" GST_TIME_FORMAT " total", in_plugin->name,
+        GST_TIME_ARGS (stop - start), finder->n_probes,
+        GST_TIME_ARGS (finder->probe_time));
+    g_static_mutex_unlock (&typefind_lock);
+
+    if (res <= 0)
+      continue;
+
+    res = MAX (1, res * GST_TYPE_FIND_MAXIMUM / AVPROBE_SCORE_MAX);
+    res = MIN (res, GST_TYPE_FIND_MAXIMUM);
+    /* Restrict the probability for MPEG-TS streams, because there is
+     * probably a better version in plugins-base, if the user has a recent
+     * plugins-base (in fact we shouldn't even get here for ffmpeg mpegts or
+     * mpegtsraw typefinders, since we blacklist them) */
+    if (g_str_has_prefix (in_plugin->name, "mpegts"))
+      res = MIN (res, GST_TYPE_FIND_POSSIBLE);
+
+    if (res > best_res) {
+      best_res = res;
+      best = finder;
+      /* nothing can beat this */
+      if (res == GST_TYPE_FIND_MAXIMUM)
+        break;
+    }
+  }
 
-      sinkcaps = gst_ffmpeg_formatid_to_caps (in_plugin->name);
+  GST_DEBUG ("ran %u of %u probers in %" GST_TIME_FORMAT, n_probed,
+      finders->len, GST_TIME_ARGS (gst_util_get_timestamp () - total));
 
-      GST_LOG ("ffmpeg typefinder '%s' suggests %" GST_PTR_FORMAT ", p=%u%%",
-          in_plugin->name, sinkcaps, res);
+  if (best &&
+      (sinkcaps = gst_ffmpeg_formatid_to_caps (best->in_plugin->name))) {
+    GST_LOG ("ffmpeg typefinder '%s' suggests %" GST_PTR_FORMAT ", p=%u%%",
+        best->in_plugin->name, sinkcaps, best_res);
 
-      gst_type_find_suggest (tf, res, sinkcaps);
-    }
+    gst_type_find_suggest (tf, best_res, sinkcaps);
+    gst_caps_unref (sinkcaps);
   }
 }
 
@@ -1343,6 +2244,7 @@ gst_ffmpegdemux_loop (GstFFMpegDemux * demux)
 
   /* read a frame */
   res = av_read_frame (demux->context, &pkt);
+  gst_ffmpegdemux_update_cache_stats (demux);
   if (res < 0)
     goto read_failed;
 
@@ -1394,49 +2296,55 @@ gst_ffmpegdemux_loop (GstFFMpegDemux * demux)
   rawvideo = (avstream->codec->codec_type == CODEC_TYPE_VIDEO &&
       avstream->codec->codec_id == CODEC_ID_RAWVIDEO);
 
-  if (rawvideo)
-    outsize = gst_ffmpeg_avpicture_get_size (avstream->codec->pix_fmt,
-        avstream->codec->width, avstream->codec->height);
-  else
-    outsize = pkt.size;
+  if (!rawvideo && pkt.destruct == av_destruct_packet) {
+    /* we own the payload, pass it downstream without copying */
+    outbuf = gst_ffmpeg_packet_to_buffer (&pkt);
+    gst_buffer_set_caps (outbuf, GST_PAD_CAPS (srcpad));
+  } else {
+    if (rawvideo)
+      outsize = gst_ffmpeg_avpicture_get_size (avstream->codec->pix_fmt,
+          avstream->codec->width, avstream->codec->height);
+    else
+      outsize = pkt.size;
 
-  stream->last_flow = gst_pad_alloc_buffer_and_set_caps (srcpad,
-      GST_CLOCK_TIME_NONE, outsize, GST_PAD_CAPS (srcpad), &outbuf);
+    stream->last_flow = gst_pad_alloc_buffer_and_set_caps (srcpad,
+        GST_CLOCK_TIME_NONE, outsize, GST_PAD_CAPS (srcpad), &outbuf);
 
-  if ((ret = gst_ffmpegdemux_aggregated_flow (demux)) != GST_FLOW_OK)
-    goto no_buffer;
+    if ((ret = gst_ffmpegdemux_aggregated_flow (demux)) != GST_FLOW_OK)
+      goto no_buffer;
 
-  /* If the buffer allocation failed, don't try sending it ! */
-  if (stream->last_flow != GST_FLOW_OK)
-    goto done;
+    /* If the buffer allocation failed, don't try sending it ! */
+    if (stream->last_flow != GST_FLOW_OK)
+      goto done;
 
-  /* copy the data from packet into the target buffer
-   * and do conversions for raw video packets */
-  if (rawvideo) {
-    AVPicture src, dst;
-    const gchar *plugin_name =
-        ((GstFFMpegDemuxClass *) (G_OBJECT_GET_CLASS (demux)))->in_plugin->name;
-
-    if (strcmp (plugin_name, "gif") == 0) {
-      src.data[0] = pkt.data;
-      src.data[1] = NULL;
-      src.data[2] = NULL;
-      src.linesize[0] = avstream->codec->width * 3;;
-    } else {
-      GST_WARNING ("Unknown demuxer %s, no idea what to do", plugin_name);
-      gst_ffmpeg_avpicture_fill (&src, pkt.data,
+    /* copy the data from packet into the target buffer
+     * and do conversions for raw video packets */
+    if (rawvideo) {
+      AVPicture src, dst;
+      const gchar *plugin_name =
+          ((GstFFMpegDemuxClass *) (G_OBJECT_GET_CLASS (demux)))->in_plugin->name;
+
+      if (strcmp (plugin_name, "gif") == 0) {
+        src.data[0] = pkt.data;
+        src.data[1] = NULL;
+        src.data[2] = NULL;
+        src.linesize[0] = avstream->codec->width * 3;;
+      } else {
+        GST_WARNING ("Unknown demuxer %s, no idea what to do", plugin_name);
+        gst_ffmpeg_avpicture_fill (&src, pkt.data,
+            avstream->codec->pix_fmt, avstream->codec->width,
+            avstream->codec->height);
+      }
+
+      gst_ffmpeg_avpicture_fill (&dst, GST_BUFFER_DATA (outbuf),
           avstream->codec->pix_fmt, avstream->codec->width,
           avstream->codec->height);
-    }
-
-    gst_ffmpeg_avpicture_fill (&dst, GST_BUFFER_DATA (outbuf),
-        avstream->codec->pix_fmt, avstream->codec->width,
-        avstream->codec->height);
 
-    av_picture_copy (&dst, &src, avstream->codec->pix_fmt,
-        avstream->codec->width, avstream->codec->height);
-  } else {
-    memcpy (GST_BUFFER_DATA (outbuf), pkt.data, outsize);
+      av_picture_copy (&dst, &src, avstream->codec->pix_fmt,
+          avstream->codec->width, avstream->codec->height);
+    } else {
+      memcpy (GST_BUFFER_DATA (outbuf), pkt.data, outsize);
+    }
   }
 
   GST_BUFFER_TIMESTAMP (outbuf) = timestamp;
@@ -1458,7 +2366,11 @@ gst_ffmpegdemux_loop (GstFFMpegDemux * demux)
       "Sending out buffer time:%" GST_TIME_FORMAT " size:%d",
       GST_TIME_ARGS (timestamp), GST_BUFFER_SIZE (outbuf));
 
-  ret = stream->last_flow = gst_pad_push (srcpad, outbuf);
+  if (stream->queue)
+    ret = gst_ffmpegdemux_stream_queue_push (stream,
+        GST_MINI_OBJECT_CAST (outbuf));
+  else
+    ret = stream->last_flow = gst_pad_push (srcpad, outbuf);
 
   /* if a pad is in e.g. WRONG_STATE, we want to pause to unlock the STREAM_LOCK */
   if ((ret != GST_FLOW_OK)
@@ -1582,6 +2494,7 @@ gst_ffmpegdemux_sink_event (GstPad * sinkpad, GstEvent * event)
     case GST_EVENT_FLUSH_START:
       /* forward event */
       gst_pad_event_default (sinkpad, event);
+      gst_ffmpegdemux_flush_queues (demux, TRUE);
 
       /* now unblock the chain function */
       GST_FFMPEG_PIPE_MUTEX_LOCK (ffpipe);
@@ -1597,6 +2510,7 @@ gst_ffmpegdemux_sink_event (GstPad * sinkpad, GstEvent * event)
     case GST_EVENT_FLUSH_STOP:
       /* forward event */
       gst_pad_event_default (sinkpad, event);
+      gst_ffmpegdemux_flush_queues (demux, FALSE);
 
       GST_OBJECT_LOCK (demux);
       g_list_foreach (demux->cached_events, (GFunc) gst_mini_object_unref,
@@ -1673,11 +2587,23 @@ gst_ffmpegdemux_chain (GstPad * sinkpad, GstBuffer * buffer)
   GST_DEBUG ("Giving a buffer of %d bytes", GST_BUFFER_SIZE (buffer));
   gst_adapter_push (ffpipe->adapter, buffer);
   buffer = NULL;
-  while (gst_adapter_available (ffpipe->adapter) >= ffpipe->needed) {
+
+  /* only wake up the src task when it has enough to continue */
+  if (ffpipe->needed && gst_adapter_available (ffpipe->adapter) >=
+      ffpipe->needed) {
     GST_DEBUG ("Adapter has more that requested (ffpipe->needed:%d)",
         ffpipe->needed);
     GST_FFMPEG_PIPE_SIGNAL (ffpipe);
+  }
+
+  /* block when we have enough queued and the src task is not waiting for
+   * more, it wakes us up below the low watermark */
+  while (gst_adapter_available (ffpipe->adapter) >= ffpipe->high_watermark
+      && !ffpipe->needed) {
+    GST_DEBUG ("Adapter above high watermark, waiting");
+    ffpipe->full = TRUE;
     GST_FFMPEG_PIPE_WAIT (ffpipe);
+    ffpipe->full = FALSE;
     /* may have become flushing */
     if (G_UNLIKELY (ffpipe->srcresult != GST_FLOW_OK))
       goto ignore;
@@ -1748,6 +2674,7 @@ gst_ffmpegdemux_sink_activate_push (GstPad * sinkpad, gboolean active)
     demux->ffpipe.eos = FALSE;
     demux->ffpipe.srcresult = GST_FLOW_OK;
     demux->ffpipe.needed = 0;
+    demux->ffpipe.full = FALSE;
     demux->running = TRUE;
     demux->seekable = FALSE;
     res = gst_task_start (demux->task);
@@ -1849,7 +2776,10 @@ gst_ffmpegdemux_register (GstPlugin * plugin)
 {
   GType type;
   AVInputFormat *in_plugin;
-  gchar **extensions;
+  GPtrArray *finders, *probers;
+  GString *extensions;
+  gchar **exts;
+  guint i;
   GTypeInfo typeinfo = {
     sizeof (GstFFMpegDemuxClass),
     (GBaseInitFunc) gst_ffmpegdemux_base_init,
@@ -1864,10 +2794,14 @@ gst_ffmpegdemux_register (GstPlugin * plugin)
 
   in_plugin = av_iformat_next (NULL);
 
+  finders = g_ptr_array_new ();
+  probers = g_ptr_array_new ();
+  extensions = g_string_new (NULL);
+
   GST_LOG ("Registering demuxers");
 
   while (in_plugin) {
-    gchar *type_name, *typefind_name;
+    gchar *type_name;
     gchar *p, *name = NULL;
     gint rank;
     gboolean register_typefind_func = TRUE;
@@ -1939,6 +2873,12 @@ gst_ffmpegdemux_register (GstPlugin * plugin)
         )
       register_typefind_func = FALSE;
 
+    /* A format that is only probed when its signature matches can't claim
+     * other data and costs next to nothing, keep it as a fallback for when
+     * the better typefinder is not installed */
+    if (gst_ffmpegdemux_type_find_get_magic (in_plugin->name))
+      register_typefind_func = TRUE;
+
     /* Set the rank of demuxers know to work to MARGINAL.
      * Set demuxers for which we already have another implementation to NONE
      * Set All others to NONE*/
@@ -1993,32 +2933,32 @@ gst_ffmpegdemux_register (GstPlugin * plugin)
       goto next;
     }
 
-    typefind_name = g_strdup_printf ("fftype_%s", name);
-
     /* create the type now */
     type = g_type_register_static (GST_TYPE_ELEMENT, type_name, &typeinfo, 0);
     g_type_set_qdata (type, GST_FFDEMUX_PARAMS_QDATA, (gpointer) in_plugin);
 
-    if (in_plugin->extensions)
-      extensions = g_strsplit (in_plugin->extensions, " ", 0);
-    else
-      extensions = NULL;
-
-    if (!gst_element_register (plugin, type_name, rank, type) ||
-        (register_typefind_func == TRUE &&
-            !gst_type_find_register (plugin, typefind_name, rank,
-                gst_ffmpegdemux_type_find, extensions, NULL, in_plugin,
-                NULL))) {
+    if (!gst_element_register (plugin, type_name, rank, type)) {
       g_warning ("Register of type ffdemux_%s failed", name);
       g_free (type_name);
-      g_free (typefind_name);
-      return FALSE;
+      g_free (name);
+      goto failed;
+    }
+
+    if (register_typefind_func && in_plugin->read_probe) {
+      GstFFMpegTypeFinder *finder = g_new0 (GstFFMpegTypeFinder, 1);
+
+      finder->in_plugin = in_plugin;
+      finder->magic = gst_ffmpegdemux_type_find_get_magic (in_plugin->name);
+      g_ptr_array_add (finder->magic ? finders : probers, finder);
+
+      if (in_plugin->extensions) {
+        if (extensions->len)
+          g_string_append_c (extensions, ',');
+        g_string_append (extensions, in_plugin->extensions);
+      }
     }
 
     g_free (type_name);
-    g_free (typefind_name);
-    if (extensions)
-      g_strfreev (extensions);
 
   next:
     g_free (name);
@@ -2027,5 +2967,32 @@ gst_ffmpegdemux_register (GstPlugin * plugin)
 
   GST_LOG ("Finished registering demuxers");
 
+  /* formats with a signature go first */
+  for (i = 0; i < probers->len; i++)
+    g_ptr_array_add (finders, g_ptr_array_index (probers, i));
+  g_ptr_array_free (probers, TRUE);
+
+  /* one typefinder for all formats, the finders are kept for the lifetime
+   * of the process */
+  exts = g_strsplit (extensions->str, ",", 0);
+  g_string_free (extensions, TRUE);
+  if (!gst_type_find_register (plugin, "fftype_ffmpeg", GST_RANK_MARGINAL,
+          gst_ffmpegdemux_type_find, exts, NULL, finders, NULL)) {
+    g_warning ("Register of ffmpeg typefinder failed");
+    g_strfreev (exts);
+    return FALSE;
+  }
+  g_strfreev (exts);
+
+  GST_LOG ("Registered typefinder for %u formats", finders->len);
+
   return TRUE;
+
+failed:
+  g_ptr_array_foreach (finders, (GFunc) g_free, NULL);
+  g_ptr_array_free (finders, TRUE);
+  g_ptr_array_foreach (probers, (GFunc) g_free, NULL);
+  g_ptr_array_free (probers, TRUE);
+  g_string_free (extensions, TRUE);
+  return FALSE;
 }
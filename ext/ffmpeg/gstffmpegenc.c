@@ -126,7 +126,7 @@ gst_ffmpegenc_base_init (GstFFMpegEncClass * klass)
   AVCodec *in_plugin;
   GstPadTemplate *srctempl = NULL, *sinktempl = NULL;
   GstCaps *srccaps = NULL, *sinkcaps = NULL;
-  gchar *longname, *classification, *description;
+  gchar *longname, *classification, *description, *key;
 
   in_plugin =
       (AVCodec *) g_type_get_qdata (G_OBJECT_CLASS_TYPE (klass),
@@ -146,7 +146,13 @@ gst_ffmpegenc_base_init (GstFFMpegEncClass * klass)
   g_free (classification);
   g_free (description);
 
-  if (!(srccaps = gst_ffmpeg_codecid_to_caps (in_plugin->id, NULL, TRUE))) {
+  key = g_strdup_printf ("ffenc-%s-src", in_plugin->name);
+  if (!gst_ffmpeg_caps_cache_get (key, &srccaps)) {
+    srccaps = gst_ffmpeg_codecid_to_caps (in_plugin->id, NULL, TRUE);
+    gst_ffmpeg_caps_cache_put (key, srccaps);
+  }
+  g_free (key);
+  if (!srccaps) {
     GST_DEBUG ("Couldn't get source caps for encoder '%s'", in_plugin->name);
     srccaps = gst_caps_new_simple ("unknown/unknown", NULL);
   }
@@ -155,8 +161,13 @@ gst_ffmpegenc_base_init (GstFFMpegEncClass * klass)
     sinkcaps = gst_caps_from_string
         ("video/x-raw-rgb; video/x-raw-yuv; video/x-raw-gray");
   } else {
-    sinkcaps = gst_ffmpeg_codectype_to_audio_caps (NULL,
-        in_plugin->id, TRUE, in_plugin);
+    key = g_strdup_printf ("ffenc-%s-sink", in_plugin->name);
+    if (!gst_ffmpeg_caps_cache_get (key, &sinkcaps)) {
+      sinkcaps = gst_ffmpeg_codectype_to_audio_caps (NULL,
+          in_plugin->id, TRUE, in_plugin);
+      gst_ffmpeg_caps_cache_put (key, sinkcaps);
+    }
+    g_free (key);
   }
   if (!sinkcaps) {
     GST_DEBUG ("Couldn't get sink caps for encoder '%s'", in_plugin->name);
@@ -267,6 +278,7 @@ gst_ffmpegenc_init (GstFFMpegEnc * ffmpegenc)
     ffmpegenc->lmin = 2;
     ffmpegenc->lmax = 31;
     ffmpegenc->max_key_interval = 0;
+    ffmpegenc->threads = 1;
 
     gst_ffmpeg_cfg_set_defaults (ffmpegenc);
   } else if (oclass->in_plugin->type == CODEC_TYPE_AUDIO) {
@@ -640,10 +652,30 @@ gst_ffmpegenc_setcaps (GstPad * pad, GstCaps * caps)
         : ffmpegenc->max_key_interval;
   }
 
+  /* slice threading; the encoder refuses more threads than MB rows */
+  if (ffmpegenc->threads != 1 && ffmpegenc->context->height > 0) {
+    gint n_threads;
+
+    if (ffmpegenc->threads == 0)
+      n_threads = gst_ffmpeg_auto_max_threads ();
+    else
+      n_threads = ffmpegenc->threads;
+    n_threads = MIN (n_threads, GST_FFMPEG_MAX_THREADS);
+    n_threads = MIN (n_threads, (ffmpegenc->context->height + 15) / 16);
+
+    GST_DEBUG_OBJECT (ffmpegenc, "using %d encoding threads", n_threads);
+    if (avcodec_thread_init (ffmpegenc->context, n_threads) < 0) {
+      GST_WARNING_OBJECT (ffmpegenc, "failed to start encoding threads");
+      ffmpegenc->context->thread_count = 1;
+    }
+  }
+
   /* open codec */
   if (gst_ffmpeg_avcodec_open (ffmpegenc->context, oclass->in_plugin) < 0) {
     if (ffmpegenc->context->priv_data)
       gst_ffmpeg_avcodec_close (ffmpegenc->context);
+    else if (ffmpegenc->context->thread_opaque)
+      avcodec_thread_free (ffmpegenc->context);
     if (ffmpegenc->context->stats_in)
       g_free (ffmpegenc->context->stats_in);
     GST_DEBUG_OBJECT (ffmpegenc, "ffenc_%s: Failed to open FFMPEG codec",
@@ -727,6 +759,12 @@ gst_ffmpegenc_setcaps (GstPad * pad, GstCaps * caps)
   return TRUE;
 }
 
+/* Encoded frames are written back to back into one big working buffer and
+ * pushed downstream as subbuffers of it, so we neither copy nor allocate
+ * per frame. The working buffer is recycled as soon as downstream released
+ * all the frames that live in it. */
+#define WORKING_BUF_FRAMES 2
+
 static void
 ffmpegenc_setup_working_buf (GstFFMpegEnc * ffmpegenc)
 {
@@ -736,16 +774,48 @@ ffmpegenc_setup_working_buf (GstFFMpegEnc * ffmpegenc)
 
   /* Above is the buffer size used by ffmpeg/ffmpeg.c */
 
-  if (ffmpegenc->working_buf == NULL ||
-      ffmpegenc->working_buf_size != wanted_size) {
-    if (ffmpegenc->working_buf)
-      g_free (ffmpegenc->working_buf);
+  if (ffmpegenc->working_buf != NULL) {
+    if (ffmpegenc->working_buf_size != wanted_size) {
+      gst_buffer_unref (ffmpegenc->working_buf);
+      ffmpegenc->working_buf = NULL;
+    } else if (GST_MINI_OBJECT_REFCOUNT_VALUE (ffmpegenc->working_buf) == 1) {
+      /* no subbuffers alive anymore, start over at the beginning */
+      ffmpegenc->working_buf_offset = 0;
+    } else if (GST_BUFFER_SIZE (ffmpegenc->working_buf) -
+        ffmpegenc->working_buf_offset < wanted_size) {
+      /* full, the last subbuffer going away will free it */
+      GST_LOG_OBJECT (ffmpegenc, "working buffer full, allocating a new one");
+      gst_buffer_unref (ffmpegenc->working_buf);
+      ffmpegenc->working_buf = NULL;
+    }
+  }
+
+  if (ffmpegenc->working_buf == NULL) {
     ffmpegenc->working_buf_size = wanted_size;
-    ffmpegenc->working_buf = g_malloc (ffmpegenc->working_buf_size);
+    ffmpegenc->working_buf =
+        new_aligned_buffer (wanted_size * WORKING_BUF_FRAMES, NULL);
+    ffmpegenc->working_buf_offset = 0;
   }
   ffmpegenc->buffer_size = wanted_size;
 }
 
+/* wrap the last encoded frame of size bytes into a buffer for downstream */
+static GstBuffer *
+ffmpegenc_take_working_buf (GstFFMpegEnc * ffmpegenc, gint size)
+{
+  GstBuffer *outbuf;
+
+  outbuf = gst_buffer_create_sub (ffmpegenc->working_buf,
+      ffmpegenc->working_buf_offset, size);
+
+  /* keep the next frame aligned */
+  ffmpegenc->working_buf_offset =
+      MIN (GST_ROUND_UP_16 (ffmpegenc->working_buf_offset + size),
+      GST_BUFFER_SIZE (ffmpegenc->working_buf));
+
+  return outbuf;
+}
+
 static GstFlowReturn
 gst_ffmpegenc_chain_video (GstPad * pad, GstBuffer * inbuf)
 {
@@ -779,7 +849,8 @@ gst_ffmpegenc_chain_video (GstPad * pad, GstBuffer * inbuf)
   ffmpegenc_setup_working_buf (ffmpegenc);
 
   ret_size = avcodec_encode_video (ffmpegenc->context,
-      ffmpegenc->working_buf, ffmpegenc->working_buf_size, ffmpegenc->picture);
+      GST_BUFFER_DATA (ffmpegenc->working_buf) + ffmpegenc->working_buf_offset,
+      ffmpegenc->working_buf_size, ffmpegenc->picture);
 
   if (ret_size < 0) {
 #ifndef GST_DISABLE_GST_DEBUG
@@ -808,8 +879,7 @@ gst_ffmpegenc_chain_video (GstPad * pad, GstBuffer * inbuf)
           (("Could not write to file \"%s\"."), ffmpegenc->filename),
           GST_ERROR_SYSTEM);
 
-  outbuf = gst_buffer_new_and_alloc (ret_size);
-  memcpy (GST_BUFFER_DATA (outbuf), ffmpegenc->working_buf, ret_size);
+  outbuf = ffmpegenc_take_working_buf (ffmpegenc, ret_size);
   GST_BUFFER_TIMESTAMP (outbuf) = GST_BUFFER_TIMESTAMP (inbuf);
   GST_BUFFER_DURATION (outbuf) = GST_BUFFER_DURATION (inbuf);
   /* buggy codec may not set coded_frame */
@@ -1069,7 +1139,8 @@ gst_ffmpegenc_flush_buffers (GstFFMpegEnc * ffmpegenc, gboolean send)
     ffmpegenc_setup_working_buf (ffmpegenc);
 
     ret_size = avcodec_encode_video (ffmpegenc->context,
-        ffmpegenc->working_buf, ffmpegenc->working_buf_size, NULL);
+        GST_BUFFER_DATA (ffmpegenc->working_buf) +
+        ffmpegenc->working_buf_offset, ffmpegenc->working_buf_size, NULL);
 
     if (ret_size < 0) {         /* there should be something, notify and give up */
 #ifndef GST_DISABLE_GST_DEBUG
@@ -1091,8 +1162,7 @@ gst_ffmpegenc_flush_buffers (GstFFMpegEnc * ffmpegenc, gboolean send)
     /* handle b-frame delay when no output, so we don't output empty frames */
     inbuf = g_queue_pop_head (ffmpegenc->delay);
 
-    outbuf = gst_buffer_new_and_alloc (ret_size);
-    memcpy (GST_BUFFER_DATA (outbuf), ffmpegenc->working_buf, ret_size);
+    outbuf = ffmpegenc_take_working_buf (ffmpegenc, ret_size);
     GST_BUFFER_TIMESTAMP (outbuf) = GST_BUFFER_TIMESTAMP (inbuf);
     GST_BUFFER_DURATION (outbuf) = GST_BUFFER_DURATION (inbuf);
 
@@ -1271,7 +1341,7 @@ gst_ffmpegenc_change_state (GstElement * element, GstStateChange transition)
         ffmpegenc->file = NULL;
       }
       if (ffmpegenc->working_buf) {
-        g_free (ffmpegenc->working_buf);
+        gst_buffer_unref (ffmpegenc->working_buf);
         ffmpegenc->working_buf = NULL;
       }
       break;
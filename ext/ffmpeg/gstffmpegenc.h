@@ -53,8 +53,10 @@ struct _GstFFMpegEnc
   gulong buffer_size;
   gulong rtp_payload_size;
 
-  guint8 *working_buf;
+  /* encoded frames are pushed as subbuffers of this */
+  GstBuffer *working_buf;
   gulong working_buf_size;
+  guint working_buf_offset;
 
   /* settings with some special handling */
   guint pass;
@@ -64,6 +66,7 @@ struct _GstFFMpegEnc
   guint lmax;
   gint max_key_interval;
   gboolean interlaced;
+  gint threads;
 
   /* statistics file */
   FILE *file;
@@ -70,6 +70,7 @@ struct _GstFFMpegMux
   GstPadEventFunction event_function;
   int preload;
   int max_delay;
+  guint write_size;
 };
 
 typedef struct _GstFFMpegMuxClass GstFFMpegMuxClass;
@@ -109,6 +110,7 @@ enum
   PROP_0,
   PROP_PRELOAD,
   PROP_MAXDELAY,
+  PROP_WRITE_SIZE,
 #ifdef GST_EXT_FFMUX_ENHANCEMENT
   PROP_EXPECTED_TRAILER_SIZE,
   PROP_NUMBER_VIDEO_FRAMES,
@@ -383,6 +385,44 @@ static void update_expected_trailer_size(GstFFMpegMux *ffmpegmux)
 }
 #endif /* GST_EXT_FFMUX_ENHANCEMENT */
 
+/* get the sink caps for all codecs the format can contain, either from the
+ * caps cache or from the codec map */
+static gboolean
+gst_ffmpegmux_get_sink_caps (AVOutputFormat * in_plugin,
+    GstCaps ** videosinkcaps, GstCaps ** audiosinkcaps)
+{
+  enum CodecID *video_ids = NULL, *audio_ids = NULL;
+  gchar *vkey, *akey;
+  gboolean res = TRUE;
+
+  vkey = g_strdup_printf ("ffmux-%s-video", in_plugin->name);
+  akey = g_strdup_printf ("ffmux-%s-audio", in_plugin->name);
+
+  if (gst_ffmpeg_caps_cache_get (vkey, videosinkcaps)) {
+    if (gst_ffmpeg_caps_cache_get (akey, audiosinkcaps))
+      goto done;
+    if (*videosinkcaps)
+      gst_caps_unref (*videosinkcaps);
+  }
+
+  if (!gst_ffmpeg_formatid_get_codecids (in_plugin->name,
+          &video_ids, &audio_ids, in_plugin)) {
+    res = FALSE;
+    goto done;
+  }
+
+  *videosinkcaps = video_ids ? gst_ffmpegmux_get_id_caps (video_ids) : NULL;
+  *audiosinkcaps = audio_ids ? gst_ffmpegmux_get_id_caps (audio_ids) : NULL;
+  gst_ffmpeg_caps_cache_put (vkey, *videosinkcaps);
+  gst_ffmpeg_caps_cache_put (akey, *audiosinkcaps);
+
+done:
+  g_free (vkey);
+  g_free (akey);
+
+  return res;
+}
+
 static void
 gst_ffmpegmux_base_init (gpointer g_class)
 {
@@ -391,8 +431,7 @@ gst_ffmpegmux_base_init (gpointer g_class)
   GstPadTemplate *videosinktempl, *audiosinktempl, *srctempl;
   AVOutputFormat *in_plugin;
   GstCaps *srccaps, *audiosinkcaps, *videosinkcaps;
-  enum CodecID *video_ids = NULL, *audio_ids = NULL;
-  gchar *longname, *description;
+  gchar *longname, *description, *key;
   const char *replacement;
   gboolean is_formatter;
 
@@ -427,15 +466,20 @@ gst_ffmpegmux_base_init (gpointer g_class)
   g_free (description);
 
   /* Try to find the caps that belongs here */
-  srccaps = gst_ffmpeg_formatid_to_caps (in_plugin->name);
+  key = g_strdup_printf ("ffmux-%s-src", in_plugin->name);
+  if (!gst_ffmpeg_caps_cache_get (key, &srccaps)) {
+    srccaps = gst_ffmpeg_formatid_to_caps (in_plugin->name);
+    gst_ffmpeg_caps_cache_put (key, srccaps);
+  }
+  g_free (key);
   if (!srccaps) {
     GST_DEBUG ("Couldn't get source caps for muxer '%s', skipping format",
         in_plugin->name);
     goto beach;
   }
 
-  if (!gst_ffmpeg_formatid_get_codecids (in_plugin->name,
-          &video_ids, &audio_ids, in_plugin)) {
+  if (!gst_ffmpegmux_get_sink_caps (in_plugin, &videosinkcaps,
+          &audiosinkcaps)) {
     gst_caps_unref (srccaps);
     GST_DEBUG
         ("Couldn't get sink caps for muxer '%s'. Most likely because no input format mapping exists.",
@@ -443,9 +487,6 @@ gst_ffmpegmux_base_init (gpointer g_class)
     goto beach;
   }
 
-  videosinkcaps = video_ids ? gst_ffmpegmux_get_id_caps (video_ids) : NULL;
-  audiosinkcaps = audio_ids ? gst_ffmpegmux_get_id_caps (audio_ids) : NULL;
-
   /* fix up allowed caps for some muxers */
   /* FIXME : This should be in gstffmpegcodecmap.c ! */
   if (strcmp (in_plugin->name, "flv") == 0) {
@@ -504,6 +545,12 @@ gst_ffmpegmux_class_init (GstFFMpegMuxClass * klass)
           "Set the maximum demux-decode delay (in microseconds)", 0, G_MAXINT,
           0, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_WRITE_SIZE,
+      g_param_spec_uint ("write-size", "Write size",
+          "Collect the muxed output in buffers of this many bytes before "
+          "pushing it (takes effect when the muxer starts)", 1, G_MAXUINT,
+          GST_FFMPEG_URL_DEFAULT_WRITE_SIZE, G_PARAM_READWRITE));
+
   gstelement_class->request_new_pad = gst_ffmpegmux_request_new_pad;
   gstelement_class->change_state = gst_ffmpegmux_change_state;
   gobject_class->finalize = gst_ffmpegmux_finalize;
@@ -545,15 +592,13 @@ gst_ffmpegmux_init (GstFFMpegMux * ffmpegmux, GstFFMpegMuxClass * g_class)
   ffmpegmux->context = g_new0 (AVFormatContext, 1);
   ffmpegmux->context->oformat = oclass->in_plugin;
   ffmpegmux->context->nb_streams = 0;
-  g_snprintf (ffmpegmux->context->filename,
-      sizeof (ffmpegmux->context->filename),
-      "gstreamer://%p", ffmpegmux->srcpad);
   ffmpegmux->opened = FALSE;
 
   ffmpegmux->videopads = 0;
   ffmpegmux->audiopads = 0;
   ffmpegmux->preload = 0;
   ffmpegmux->max_delay = 0;
+  ffmpegmux->write_size = GST_FFMPEG_URL_DEFAULT_WRITE_SIZE;
 
 #ifdef GST_EXT_FFMUX_ENHANCEMENT
   ffmpegmux->expected_trailer_size = 0;
@@ -611,6 +656,9 @@ gst_ffmpegmux_set_property (GObject * object, guint prop_id,
     case PROP_MAXDELAY:
       src->max_delay = g_value_get_int (value);
       break;
+    case PROP_WRITE_SIZE:
+      src->write_size = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -632,6 +680,9 @@ gst_ffmpegmux_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_MAXDELAY:
       g_value_set_int (value, src->max_delay);
       break;
+    case PROP_WRITE_SIZE:
+      g_value_set_uint (value, src->write_size);
+      break;
 #ifdef GST_EXT_FFMUX_ENHANCEMENT
     case PROP_EXPECTED_TRAILER_SIZE:
       g_value_set_uint (value, src->expected_trailer_size);
@@ -812,6 +863,7 @@ gst_ffmpegmux_collected (GstCollectPads * pads, gpointer user_data)
   GstFFMpegMuxPad *best_pad;
   GstClockTime best_time;
   const GstTagList *tags;
+  GstFlowReturn ret = GST_FLOW_OK;
 
   /* open "file" (gstreamer protocol to next element) */
   if (!ffmpegmux->opened) {
@@ -903,6 +955,11 @@ gst_ffmpegmux_collected (GstCollectPads * pads, gpointer user_data)
       open_flags |= GST_FFMPEG_URL_STREAMHEADER;
     }
 
+    g_snprintf (ffmpegmux->context->filename,
+        sizeof (ffmpegmux->context->filename),
+        "gstreamer://%p?writesize=%u", ffmpegmux->srcpad,
+        ffmpegmux->write_size);
+
     if (url_fopen (&ffmpegmux->context->pb,
             ffmpegmux->context->filename, open_flags) < 0) {
       GST_ELEMENT_ERROR (ffmpegmux, LIBRARY, TOO_LAZY, (NULL),
@@ -927,7 +984,7 @@ gst_ffmpegmux_collected (GstCollectPads * pads, gpointer user_data)
     ffmpegmux->opened = TRUE;
 
     /* flush the header so it will be used as streamheader */
-    put_flush_packet (ffmpegmux->context->pb);
+    gst_ffmpeg_url_flush (ffmpegmux->context->pb);
   }
 
   /* take the one with earliest timestamp,
@@ -1070,6 +1127,9 @@ gst_ffmpegmux_collected (GstCollectPads * pads, gpointer user_data)
       pkt.duration = 0;
 #endif
     av_write_frame (ffmpegmux->context, &pkt);
+    /* push the packet out now, holding data back across packets would
+     * delay low bitrate live streams */
+    ret = gst_ffmpeg_url_flush (ffmpegmux->context->pb);
     gst_buffer_unref (buf);
     if (need_free)
       g_free (pkt.data);
@@ -1083,7 +1143,7 @@ gst_ffmpegmux_collected (GstCollectPads * pads, gpointer user_data)
     return GST_FLOW_UNEXPECTED;
   }
 
-  return GST_FLOW_OK;
+  return ret;
 }
 
 static GstStateChangeReturn
@@ -48,6 +48,11 @@ G_BEGIN_DECLS
   g_cond_signal (m->cond);                                              \
 } G_STMT_END
 
+/* the upstream thread blocks when the adapter holds more than the high
+ * watermark, and is woken up again when it drained below the low one */
+#define GST_FFMPEG_PIPE_HIGH_WATERMARK (1024 * 1024)
+#define GST_FFMPEG_PIPE_LOW_WATERMARK (256 * 1024)
+
 typedef struct _GstFFMpegPipe GstFFMpegPipe;
 
 struct _GstFFMpegPipe
@@ -65,6 +70,11 @@ struct _GstFFMpegPipe
   GstAdapter *adapter;
   /* amount needed in adapter by src task */
   guint needed;
+  /* upstream is blocked on the high watermark */
+  gboolean full;
+
+  guint high_watermark;
+  guint low_watermark;
 };
 
 G_END_DECLS
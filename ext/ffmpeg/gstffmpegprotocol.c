@@ -34,6 +34,16 @@
 #include "gstffmpeg.h"
 #include "gstffmpegpipe.h"
 
+typedef struct _GstDataBlock GstDataBlock;
+
+struct _GstDataBlock
+{
+  guint64 offset;
+  GstBuffer *buf;
+  /* for LRU eviction */
+  guint64 last_used;
+};
+
 typedef struct _GstProtocolInfo GstProtocolInfo;
 
 struct _GstProtocolInfo
@@ -43,8 +53,62 @@ struct _GstProtocolInfo
   guint64 offset;
   gboolean eos;
   gint set_streamheader;
+
+  /* read-ahead cache of aligned blocks */
+  guint block_size;
+  guint n_blocks;
+  GstDataBlock *blocks;
+  guint64 tick;
+
+  /* statistics */
+  guint64 hits;
+  guint64 misses;
+  guint64 bytes_pulled;
+
+  /* write mode: pending output, GST_BUFFER_SIZE is the amount of data in
+   * it, write_size the allocated size */
+  guint write_size;
+  GstBuffer *wbuf;
 };
 
+/* Looks up key in the options of a gstreamer://<pad>?key=value&... URL.
+ * value is only changed when the key is present with a valid number. */
+static gboolean
+gst_ffmpegdata_get_option (const gchar * filename, const gchar * key,
+    guint * value)
+{
+  const gchar *options;
+  gchar **opts;
+  gboolean res = FALSE;
+  gint i;
+
+  if ((options = strchr (filename, '?')) == NULL)
+    return FALSE;
+
+  opts = g_strsplit (options + 1, "&", -1);
+  for (i = 0; opts[i]; i++) {
+    gchar *val, *end;
+    guint64 v;
+
+    if ((val = strchr (opts[i], '=')) == NULL)
+      continue;
+    *val++ = '\0';
+    if (strcmp (opts[i], key))
+      continue;
+
+    v = g_ascii_strtoull (val, &end, 10);
+    if (*val == '\0' || *end != '\0' || v > G_MAXUINT) {
+      GST_WARNING ("invalid value '%s' for option %s", val, key);
+      continue;
+    }
+    *value = (guint) v;
+    res = TRUE;
+  }
+  g_strfreev (opts);
+
+  return res;
+}
+
 static int
 gst_ffmpegdata_open (URLContext * h, const char *filename, int flags)
 {
@@ -86,6 +150,29 @@ gst_ffmpegdata_open (URLContext * h, const char *filename, int flags)
   info->pad = pad;
   info->offset = 0;
 
+  if (flags == URL_RDONLY) {
+    guint block_size = GST_FFMPEG_URL_DEFAULT_BLOCK_SIZE;
+    guint n_blocks = GST_FFMPEG_URL_DEFAULT_BLOCKS;
+
+    gst_ffmpegdata_get_option (filename, "blocksize", &block_size);
+    gst_ffmpegdata_get_option (filename, "blocks", &n_blocks);
+    GST_LOG ("read-ahead cache of %u blocks of %u bytes", n_blocks,
+        block_size);
+
+    if (block_size > 0 && n_blocks > 0) {
+      info->block_size = block_size;
+      info->n_blocks = n_blocks;
+      info->blocks = g_new0 (GstDataBlock, n_blocks);
+    }
+  } else {
+    guint write_size = GST_FFMPEG_URL_DEFAULT_WRITE_SIZE;
+
+    gst_ffmpegdata_get_option (filename, "writesize", &write_size);
+    GST_LOG ("pushing output in chunks of %u bytes", write_size);
+
+    info->write_size = write_size;
+  }
+
   h->priv_data = (void *) info;
   h->is_streamed = FALSE;
   h->max_packet_size = 0;
@@ -93,12 +180,114 @@ gst_ffmpegdata_open (URLContext * h, const char *filename, int flags)
   return 0;
 }
 
+static gint
+gst_ffmpegdata_flow_to_result (GstFlowReturn ret)
+{
+  switch (ret) {
+    case GST_FLOW_OK:
+    case GST_FLOW_UNEXPECTED:
+      return 0;
+    case GST_FLOW_WRONG_STATE:
+      return -1;
+    default:
+    case GST_FLOW_ERROR:
+      return -2;
+  }
+}
+
+/* Upstream may return less than asked for before the end of the stream,
+ * pull the rest of a short block until it covers offset. A block that stays
+ * short is at the end of the stream. */
+static GstFlowReturn
+gst_ffmpegdata_fill_block (GstProtocolInfo * info, GstDataBlock * block,
+    guint64 offset)
+{
+  while (offset - block->offset >= GST_BUFFER_SIZE (block->buf) &&
+      GST_BUFFER_SIZE (block->buf) < info->block_size) {
+    guint size = GST_BUFFER_SIZE (block->buf);
+    GstBuffer *buf = NULL, *merged;
+    GstFlowReturn ret;
+
+    GST_DEBUG ("Pulling %u missing bytes at position %" G_GUINT64_FORMAT,
+        info->block_size - size, block->offset + size);
+
+    ret = gst_pad_pull_range (info->pad, block->offset + size,
+        info->block_size - size, &buf);
+    if (ret != GST_FLOW_OK)
+      return ret;
+
+    info->bytes_pulled += GST_BUFFER_SIZE (buf);
+    if (GST_BUFFER_SIZE (buf) == 0) {
+      gst_buffer_unref (buf);
+      break;
+    }
+
+    merged = gst_buffer_merge (block->buf, buf);
+    gst_buffer_unref (block->buf);
+    gst_buffer_unref (buf);
+    block->buf = merged;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* get the cached block containing offset, pulling it when needed */
+static GstFlowReturn
+gst_ffmpegdata_get_block (GstProtocolInfo * info, guint64 offset,
+    GstDataBlock ** result)
+{
+  GstDataBlock *block, *victim = NULL;
+  GstBuffer *buf = NULL;
+  GstFlowReturn ret;
+  guint64 start;
+  guint i;
+
+  start = offset - offset % info->block_size;
+  info->tick++;
+
+  for (i = 0; i < info->n_blocks; i++) {
+    block = &info->blocks[i];
+
+    if (block->buf != NULL && block->offset == start) {
+      info->hits++;
+      block->last_used = info->tick;
+      *result = block;
+      return gst_ffmpegdata_fill_block (info, block, offset);
+    }
+    /* empty blocks first, then the least recently used one */
+    if (victim == NULL || (victim->buf != NULL &&
+            (block->buf == NULL || block->last_used < victim->last_used)))
+      victim = block;
+  }
+
+  info->misses++;
+
+  GST_DEBUG ("Pulling block of %u bytes at position %" G_GUINT64_FORMAT,
+      info->block_size, start);
+
+  ret = gst_pad_pull_range (info->pad, start, info->block_size, &buf);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  info->bytes_pulled += GST_BUFFER_SIZE (buf);
+
+  if (victim->buf)
+    gst_buffer_unref (victim->buf);
+  victim->buf = buf;
+  victim->offset = start;
+  victim->last_used = info->tick;
+  *result = victim;
+
+  return gst_ffmpegdata_fill_block (info, victim, offset);
+}
+
 static int
 gst_ffmpegdata_peek (URLContext * h, unsigned char *buf, int size)
 {
   GstProtocolInfo *info;
   GstBuffer *inbuf = NULL;
-  GstFlowReturn ret;
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint64 offset;
   int total = 0;
 
   g_return_val_if_fail (h->flags == URL_RDONLY, AVERROR_IO);
@@ -107,26 +296,46 @@ gst_ffmpegdata_peek (URLContext * h, unsigned char *buf, int size)
   GST_DEBUG ("Pulling %d bytes at position %" G_GUINT64_FORMAT, size,
       info->offset);
 
-  ret = gst_pad_pull_range (info->pad, info->offset, (guint) size, &inbuf);
-
-  switch (ret) {
-    case GST_FLOW_OK:
+  /* big reads gain nothing from the cache, pull them directly */
+  if (info->blocks == NULL || (guint) size >= info->block_size) {
+    ret = gst_pad_pull_range (info->pad, info->offset, (guint) size, &inbuf);
+    if (ret == GST_FLOW_OK) {
       total = (gint) GST_BUFFER_SIZE (inbuf);
       memcpy (buf, GST_BUFFER_DATA (inbuf), total);
       gst_buffer_unref (inbuf);
+      info->misses++;
+      info->bytes_pulled += total;
+    } else {
+      total = gst_ffmpegdata_flow_to_result (ret);
+    }
+    goto done;
+  }
+
+  offset = info->offset;
+  while (total < size) {
+    GstDataBlock *block;
+    guint skip, avail;
+
+    ret = gst_ffmpegdata_get_block (info, offset, &block);
+    if (ret != GST_FLOW_OK)
       break;
-    case GST_FLOW_UNEXPECTED:
-      total = 0;
-      break;
-    case GST_FLOW_WRONG_STATE:
-      total = -1;
-      break;
-    default:
-    case GST_FLOW_ERROR:
-      total = -2;
+
+    /* a block that is still short after filling ends the stream */
+    skip = offset - block->offset;
+    if (skip >= GST_BUFFER_SIZE (block->buf))
       break;
+
+    avail = MIN (GST_BUFFER_SIZE (block->buf) - skip, size - total);
+    memcpy (buf + total, GST_BUFFER_DATA (block->buf) + skip, avail);
+    total += avail;
+    offset += avail;
   }
 
+  /* only report errors when we have nothing */
+  if (total == 0)
+    total = gst_ffmpegdata_flow_to_result (ret);
+
+done:
   GST_DEBUG ("Got %d (%s) return result %d", ret, gst_flow_get_name (ret),
       total);
 
@@ -153,6 +362,33 @@ gst_ffmpegdata_read (URLContext * h, unsigned char *buf, int size)
   return res;
 }
 
+/* push the pending output downstream */
+static GstFlowReturn
+gst_ffmpegdata_write_flush (GstProtocolInfo * info)
+{
+  GstBuffer *outbuf = info->wbuf;
+
+  if (outbuf == NULL)
+    return GST_FLOW_OK;
+
+  info->wbuf = NULL;
+  if (GST_BUFFER_SIZE (outbuf) == 0) {
+    gst_buffer_unref (outbuf);
+    return GST_FLOW_OK;
+  }
+
+  GST_DEBUG ("Pushing %u bytes at offset %" G_GUINT64_FORMAT,
+      GST_BUFFER_SIZE (outbuf), GST_BUFFER_OFFSET (outbuf));
+  gst_buffer_set_caps (outbuf, GST_PAD_CAPS (info->pad));
+
+  return gst_pad_push (info->pad, outbuf);
+}
+
+/* Writes are collected in a buffer of write_size bytes that is pushed when
+ * it is full, before a seek, when closing and at the end of every muxed
+ * packet with gst_ffmpeg_url_flush(). libavformat writes a packet in many
+ * small pieces, pushing all of those separately results in lots of tiny
+ * buffers. */
 static int
 gst_ffmpegdata_write (URLContext * h, unsigned char *buf, int size)
 {
@@ -164,20 +400,80 @@ gst_ffmpegdata_write (URLContext * h, unsigned char *buf, int size)
 
   g_return_val_if_fail (h->flags != URL_RDONLY, -EIO);
 
-  /* create buffer and push data further */
-  if (gst_pad_alloc_buffer_and_set_caps (info->pad,
-          info->offset, size, GST_PAD_CAPS (info->pad), &outbuf) != GST_FLOW_OK)
+  /* make room for the new data */
+  if (info->wbuf &&
+      GST_BUFFER_SIZE (info->wbuf) + size > info->write_size &&
+      gst_ffmpegdata_write_flush (info) != GST_FLOW_OK)
     return 0;
 
-  memcpy (GST_BUFFER_DATA (outbuf), buf, size);
+  /* too big to collect, push it out directly */
+  if ((guint) size >= info->write_size) {
+    if (gst_pad_alloc_buffer_and_set_caps (info->pad,
+            info->offset, size, GST_PAD_CAPS (info->pad),
+            &outbuf) != GST_FLOW_OK)
+      return 0;
 
-  if (gst_pad_push (info->pad, outbuf) != GST_FLOW_OK)
-    return 0;
+    memcpy (GST_BUFFER_DATA (outbuf), buf, size);
+
+    if (gst_pad_push (info->pad, outbuf) != GST_FLOW_OK)
+      return 0;
+
+    info->offset += size;
+    return size;
+  }
+
+  if (info->wbuf == NULL) {
+    info->wbuf = gst_buffer_new_and_alloc (info->write_size);
+    GST_BUFFER_SIZE (info->wbuf) = 0;
+    GST_BUFFER_OFFSET (info->wbuf) = info->offset;
+  }
+
+  memcpy (GST_BUFFER_DATA (info->wbuf) + GST_BUFFER_SIZE (info->wbuf), buf,
+      size);
+  GST_BUFFER_SIZE (info->wbuf) += size;
 
   info->offset += size;
   return size;
 }
 
+/* push out everything libavformat and gstreamer:// have buffered so far */
+GstFlowReturn
+gst_ffmpeg_url_flush (ByteIOContext * pb)
+{
+  URLContext *h = (URLContext *) pb->opaque;
+
+  put_flush_packet (pb);
+
+  if (h && h->prot == &gstreamer_protocol && h->flags == URL_WRONLY &&
+      h->priv_data)
+    return gst_ffmpegdata_write_flush ((GstProtocolInfo *) h->priv_data);
+
+  return GST_FLOW_OK;
+}
+
+/* get the statistics of the read-ahead cache, FALSE if pb doesn't read from
+ * gstreamer:// with a cache */
+gboolean
+gst_ffmpeg_url_get_cache_stats (ByteIOContext * pb, guint64 * hits,
+    guint64 * misses)
+{
+  URLContext *h = (URLContext *) pb->opaque;
+  GstProtocolInfo *info;
+
+  if (h == NULL || h->prot != &gstreamer_protocol || h->flags != URL_RDONLY ||
+      h->priv_data == NULL)
+    return FALSE;
+
+  info = (GstProtocolInfo *) h->priv_data;
+  if (info->blocks == NULL)
+    return FALSE;
+
+  *hits = info->hits;
+  *misses = info->misses;
+
+  return TRUE;
+}
+
 static int64_t
 gst_ffmpegdata_seek (URLContext * h, int64_t pos, int whence)
 {
@@ -231,21 +527,31 @@ gst_ffmpegdata_seek (URLContext * h, int64_t pos, int whence)
       /* srcpad */
       switch (whence) {
         case SEEK_SET:
-          info->offset = (guint64) pos;
-          gst_pad_push_event (info->pad, gst_event_new_new_segment
-              (TRUE, 1.0, GST_FORMAT_BYTES, info->offset,
-                  GST_CLOCK_TIME_NONE, info->offset));
+          newpos = (guint64) pos;
           break;
         case SEEK_CUR:
-          info->offset += pos;
-          gst_pad_push_event (info->pad, gst_event_new_new_segment
-              (TRUE, 1.0, GST_FORMAT_BYTES, info->offset,
-                  GST_CLOCK_TIME_NONE, info->offset));
+          newpos = info->offset + pos;
           break;
         default:
+          newpos = info->offset;
           break;
       }
-      newpos = info->offset;
+      /* the pending data has to go out at the old position, the data
+       * written after the seek is collected again and pushed on the next
+       * seek or flush */
+      if (newpos != info->offset) {
+        GstFlowReturn ret = gst_ffmpegdata_write_flush (info);
+
+        if (ret != GST_FLOW_OK) {
+          GST_WARNING ("Pushing pending data failed: %s",
+              gst_flow_get_name (ret));
+          return -1;
+        }
+        info->offset = newpos;
+        gst_pad_push_event (info->pad, gst_event_new_new_segment
+            (TRUE, 1.0, GST_FORMAT_BYTES, info->offset,
+                GST_CLOCK_TIME_NONE, info->offset));
+      }
     }
       break;
     default:
@@ -262,6 +568,7 @@ static int
 gst_ffmpegdata_close (URLContext * h)
 {
   GstProtocolInfo *info;
+  gint res = 0;
 
   info = (GstProtocolInfo *) h->priv_data;
   if (info == NULL)
@@ -272,6 +579,13 @@ gst_ffmpegdata_close (URLContext * h)
   switch (h->flags) {
     case URL_WRONLY:
     {
+      GstFlowReturn ret = gst_ffmpegdata_write_flush (info);
+
+      if (ret != GST_FLOW_OK) {
+        GST_WARNING ("Pushing pending data failed: %s",
+            gst_flow_get_name (ret));
+        res = -EIO;
+      }
       /* send EOS - that closes down the stream */
       gst_pad_push_event (info->pad, gst_event_new_eos ());
       break;
@@ -280,11 +594,25 @@ gst_ffmpegdata_close (URLContext * h)
       break;
   }
 
+  if (info->blocks) {
+    guint i;
+
+    GST_DEBUG ("read-ahead cache: %" G_GUINT64_FORMAT " hits, %"
+        G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " bytes pulled",
+        info->hits, info->misses, info->bytes_pulled);
+
+    for (i = 0; i < info->n_blocks; i++) {
+      if (info->blocks[i].buf)
+        gst_buffer_unref (info->blocks[i].buf);
+    }
+    g_free (info->blocks);
+  }
+
   /* clean up data */
   g_free (info);
   h->priv_data = NULL;
 
-  return 0;
+  return res;
 }
 
 
@@ -333,7 +661,6 @@ static int
 gst_ffmpeg_pipe_read (URLContext * h, unsigned char *buf, int size)
 {
   GstFFMpegPipe *ffpipe;
-  const guint8 *data;
   guint available;
 
   ffpipe = (GstFFMpegPipe *) h->priv_data;
@@ -348,20 +675,25 @@ gst_ffmpeg_pipe_read (URLContext * h, unsigned char *buf, int size)
       && !ffpipe->eos) {
     GST_DEBUG ("Available:%d, requested:%d", available, size);
     ffpipe->needed = size;
+    /* upstream only signals us once it has enough */
     GST_FFMPEG_PIPE_SIGNAL (ffpipe);
     GST_FFMPEG_PIPE_WAIT (ffpipe);
   }
+  ffpipe->needed = 0;
 
   size = MIN (available, size);
   if (size) {
     GST_LOG ("Getting %d bytes", size);
-    data = gst_adapter_peek (ffpipe->adapter, size);
-    memcpy (buf, data, size);
+    gst_adapter_copy (ffpipe->adapter, buf, 0, size);
     gst_adapter_flush (ffpipe->adapter, size);
-    GST_LOG ("%d bytes left in adapter",
-        gst_adapter_available (ffpipe->adapter));
-    ffpipe->needed = 0;
+    available -= size;
+    GST_LOG ("%d bytes left in adapter", available);
   }
+
+  /* wake up upstream when it is blocked and we drained enough */
+  if (ffpipe->full && available < ffpipe->low_watermark)
+    GST_FFMPEG_PIPE_SIGNAL (ffpipe);
+
   GST_FFMPEG_PIPE_MUTEX_UNLOCK (ffpipe);
 
   return size;
@@ -21,6 +21,17 @@
 #include "config.h"
 #endif
 #include "gstffmpegutils.h"
+#ifdef HAVE_FFMPEG_UNINSTALLED
+#include <avformat.h>
+#else
+#include <libavformat/avformat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
 
 G_CONST_RETURN gchar *
 gst_ffmpeg_get_codecid_longname (enum CodecID codec_id)
@@ -247,6 +258,19 @@ gst_ffmpeg_avpicture_get_size (int pix_fmt, int width, int height)
   return gst_ffmpeg_avpicture_fill (&dummy_pict, NULL, pix_fmt, width, height);
 }
 
+/* packed formats only use the first plane, the picture of a smaller height
+ * is then a prefix of the picture with the same width */
+gboolean
+gst_ffmpeg_avpicture_is_packed (int pix_fmt)
+{
+  AVPicture dummy_pict;
+
+  if (gst_ffmpeg_avpicture_fill (&dummy_pict, NULL, pix_fmt, 16, 16) <= 0)
+    return FALSE;
+
+  return dummy_pict.data[1] == NULL;
+}
+
 #define GEN_MASK(x) ((1<<(x))-1)
 #define ROUND_UP_X(v,x) (((v) + GEN_MASK(x)) & ~GEN_MASK(x))
 #define ROUND_UP_2(x) ROUND_UP_X (x, 1)
@@ -415,3 +439,417 @@ new_aligned_buffer (gint size, GstCaps * caps)
 
   return buf;
 }
+
+static void
+gst_ffmpeg_free_packet (gpointer data)
+{
+  AVPacket *pkt = (AVPacket *) data;
+
+  av_free_packet (pkt);
+  g_slice_free (AVPacket, pkt);
+}
+
+/* Make a buffer that takes ownership of the packet payload, the packet is
+ * freed when the buffer is. The payload of an allocated packet is followed
+ * by FF_INPUT_BUFFER_PADDING_SIZE zero bytes. */
+GstBuffer *
+gst_ffmpeg_packet_to_buffer (AVPacket * pkt)
+{
+  GstBuffer *buf;
+  AVPacket *owned;
+
+  owned = g_slice_new (AVPacket);
+  *owned = *pkt;
+  /* the buffer owns the payload now */
+  pkt->destruct = NULL;
+
+  buf = gst_buffer_new ();
+  GST_BUFFER_DATA (buf) = owned->data;
+  GST_BUFFER_SIZE (buf) = owned->size;
+  GST_BUFFER_MALLOCDATA (buf) = (guint8 *) owned;
+  GST_BUFFER_FREE_FUNC (buf) = gst_ffmpeg_free_packet;
+
+  return buf;
+}
+
+/* Check if buf still is a whole packet made by gst_ffmpeg_packet_to_buffer,
+ * so that its data is followed by the padding ffmpeg needs. Buffer flags
+ * can't be used for this, other elements copy them onto buffers without
+ * padding. */
+gboolean
+gst_ffmpeg_buffer_is_padded (GstBuffer * buf)
+{
+  AVPacket *pkt;
+
+  if (GST_BUFFER_FREE_FUNC (buf) != gst_ffmpeg_free_packet)
+    return FALSE;
+
+  pkt = (AVPacket *) GST_BUFFER_MALLOCDATA (buf);
+
+  return GST_BUFFER_DATA (buf) == pkt->data &&
+      GST_BUFFER_SIZE (buf) == pkt->size;
+}
+
+/* Memory handed out by the pool starts with this header, the buffer data
+ * follows it and stays 16 byte aligned. */
+#define POOL_HEADER_SIZE 16
+
+/* maximum number of idle chunks we keep around */
+#define POOL_MAX_FREE 8
+
+typedef struct
+{
+  GstFFMpegBufferPool *pool;
+  gint size;
+} GstFFMpegPoolHeader;
+
+struct _GstFFMpegBufferPool
+{
+  GMutex *lock;
+  gint refcount;
+
+  /* with LOCK */
+  gint size;
+  GstCaps *caps;
+  GSList *free;
+  guint n_free;
+  gboolean flushing;
+
+  guint64 hits;
+  guint64 misses;
+};
+
+static void
+gst_ffmpeg_buffer_pool_flush_unlocked (GstFFMpegBufferPool * pool)
+{
+  GSList *walk;
+
+  for (walk = pool->free; walk; walk = g_slist_next (walk))
+    av_free (walk->data);
+  g_slist_free (pool->free);
+  pool->free = NULL;
+  pool->n_free = 0;
+}
+
+static void
+gst_ffmpeg_buffer_pool_unref (GstFFMpegBufferPool * pool)
+{
+  if (!g_atomic_int_dec_and_test (&pool->refcount))
+    return;
+
+  gst_ffmpeg_buffer_pool_flush_unlocked (pool);
+  gst_caps_replace (&pool->caps, NULL);
+  g_mutex_free (pool->lock);
+  g_slice_free (GstFFMpegBufferPool, pool);
+}
+
+/* free function of pooled buffers, puts the memory back in the pool if it
+ * still matches the current size */
+static void
+gst_ffmpeg_buffer_pool_release (gpointer mem)
+{
+  GstFFMpegPoolHeader *header = (GstFFMpegPoolHeader *) mem;
+  GstFFMpegBufferPool *pool = header->pool;
+
+  g_mutex_lock (pool->lock);
+  if (!pool->flushing && header->size == pool->size &&
+      pool->n_free < POOL_MAX_FREE) {
+    pool->free = g_slist_prepend (pool->free, mem);
+    pool->n_free++;
+    mem = NULL;
+  }
+  g_mutex_unlock (pool->lock);
+
+  if (mem)
+    av_free (mem);
+
+  gst_ffmpeg_buffer_pool_unref (pool);
+}
+
+GstFFMpegBufferPool *
+gst_ffmpeg_buffer_pool_new (void)
+{
+  GstFFMpegBufferPool *pool;
+
+  pool = g_slice_new0 (GstFFMpegBufferPool);
+  pool->lock = g_mutex_new ();
+  pool->refcount = 1;
+
+  return pool;
+}
+
+/* called by the owner, the pool stays alive until all buffers are freed */
+void
+gst_ffmpeg_buffer_pool_free (GstFFMpegBufferPool * pool)
+{
+  g_mutex_lock (pool->lock);
+  pool->flushing = TRUE;
+  g_mutex_unlock (pool->lock);
+
+  gst_ffmpeg_buffer_pool_unref (pool);
+}
+
+/* release all idle memory */
+void
+gst_ffmpeg_buffer_pool_flush (GstFFMpegBufferPool * pool)
+{
+  g_mutex_lock (pool->lock);
+  gst_ffmpeg_buffer_pool_flush_unlocked (pool);
+  g_mutex_unlock (pool->lock);
+}
+
+/* Get an aligned buffer of size bytes with caps, recycling the memory of a
+ * previously freed buffer when possible. */
+GstBuffer *
+gst_ffmpeg_buffer_pool_get (GstFFMpegBufferPool * pool, gint size,
+    GstCaps * caps)
+{
+  GstBuffer *buf;
+  guint8 *mem = NULL;
+
+  g_mutex_lock (pool->lock);
+  if (size != pool->size || (caps != pool->caps && (!caps || !pool->caps ||
+              !gst_caps_is_equal (caps, pool->caps)))) {
+    GST_DEBUG ("pool reconfigured to size %d", size);
+    gst_ffmpeg_buffer_pool_flush_unlocked (pool);
+    pool->size = size;
+    gst_caps_replace (&pool->caps, caps);
+  }
+  if (pool->free) {
+    mem = pool->free->data;
+    pool->free = g_slist_delete_link (pool->free, pool->free);
+    pool->n_free--;
+    pool->hits++;
+  } else {
+    pool->misses++;
+  }
+  g_mutex_unlock (pool->lock);
+
+  if (mem == NULL) {
+    mem = (guint8 *) av_malloc (size + POOL_HEADER_SIZE);
+    ((GstFFMpegPoolHeader *) mem)->pool = pool;
+    ((GstFFMpegPoolHeader *) mem)->size = size;
+  }
+  g_atomic_int_inc (&pool->refcount);
+
+  buf = gst_buffer_new ();
+  GST_BUFFER_MALLOCDATA (buf) = mem;
+  GST_BUFFER_DATA (buf) = mem + POOL_HEADER_SIZE;
+  GST_BUFFER_SIZE (buf) = size;
+  GST_BUFFER_FREE_FUNC (buf) = gst_ffmpeg_buffer_pool_release;
+  if (caps)
+    gst_buffer_set_caps (buf, caps);
+
+  return buf;
+}
+
+void
+gst_ffmpeg_buffer_pool_get_stats (GstFFMpegBufferPool * pool, guint64 * hits,
+    guint64 * misses)
+{
+  g_mutex_lock (pool->lock);
+  if (hits)
+    *hits = pool->hits;
+  if (misses)
+    *misses = pool->misses;
+  g_mutex_unlock (pool->lock);
+}
+
+/* Number of worker threads to use when the user asked for automatic
+ * detection, this is the number of CPUs in the system. */
+gint
+gst_ffmpeg_auto_max_threads (void)
+{
+  static gsize n_threads = 0;
+
+  if (g_once_init_enter (&n_threads)) {
+    gint n = 1;
+#if defined(_WIN32)
+    {
+      const gchar *s = g_getenv ("NUMBER_OF_PROCESSORS");
+      if (s)
+        n = atoi (s);
+    }
+#elif defined(_SC_NPROCESSORS_ONLN)
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+      n = 1;
+
+    g_once_init_leave (&n_threads, n);
+  }
+
+  return (gint) n_threads;
+}
+
+/* Caps cache.
+ *
+ * Building the pad template caps of all elements through the codec map is
+ * a large part of the time needed to load the plugin. The caps are only a
+ * function of the codec/format and of the libraries we were built with, so
+ * we store them as strings in the user cache directory and parse them back
+ * on the next load. Every plugin file gets its own cache, named after a
+ * hash of its path, so that an installed and an uninstalled build don't
+ * replace each other's cache. The cache is dropped when the library
+ * versions, the plugin version or the size and mtime of the plugin file
+ * change. NULL caps are stored as an empty string.
+ */
+#define CAPS_CACHE_GROUP "caps"
+#define CAPS_CACHE_VERSION_GROUP "version"
+
+static GStaticMutex caps_cache_lock = G_STATIC_MUTEX_INIT;
+static GKeyFile *caps_cache = NULL;
+static gchar *caps_cache_file = NULL;
+static gboolean caps_cache_dirty = FALSE;
+
+static gboolean
+gst_ffmpeg_caps_cache_is_valid (GKeyFile * file, const gchar * stamp)
+{
+  gchar *version;
+  gboolean res;
+
+  if (g_key_file_get_integer (file, CAPS_CACHE_VERSION_GROUP, "avcodec",
+          NULL) != avcodec_version ())
+    return FALSE;
+  if (g_key_file_get_integer (file, CAPS_CACHE_VERSION_GROUP, "avformat",
+          NULL) != avformat_version ())
+    return FALSE;
+
+  version = g_key_file_get_string (file, CAPS_CACHE_VERSION_GROUP, "plugin",
+      NULL);
+  res = (version != NULL && !strcmp (version, PACKAGE_VERSION));
+  g_free (version);
+  if (!res)
+    return FALSE;
+
+  version = g_key_file_get_string (file, CAPS_CACHE_VERSION_GROUP, "file",
+      NULL);
+  res = (version != NULL && !strcmp (version, stamp));
+  g_free (version);
+
+  return res;
+}
+
+/* @plugin_file is the file the plugin was loaded from, without it we don't
+ * cache anything */
+void
+gst_ffmpeg_caps_cache_init (const gchar * plugin_file)
+{
+  struct stat st;
+  gchar *stamp, *hash, *name;
+
+  g_static_mutex_lock (&caps_cache_lock);
+  if (caps_cache)
+    goto done;
+
+  if (plugin_file == NULL || g_stat (plugin_file, &st) != 0) {
+    GST_DEBUG ("no plugin file, not using a caps cache");
+    goto done;
+  }
+
+  stamp = g_strdup_printf ("%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+      (gint64) st.st_size, (gint64) st.st_mtime);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, plugin_file, -1);
+  name = g_strdup_printf ("caps-%s.cache", hash);
+  caps_cache_file = g_build_filename (g_get_user_cache_dir (), "gst-ffmpeg",
+      name, NULL);
+  g_free (name);
+  g_free (hash);
+
+  caps_cache = g_key_file_new ();
+  caps_cache_dirty = FALSE;
+
+  if (g_key_file_load_from_file (caps_cache, caps_cache_file,
+          G_KEY_FILE_NONE, NULL) &&
+      gst_ffmpeg_caps_cache_is_valid (caps_cache, stamp)) {
+    g_free (stamp);
+    GST_DEBUG ("using caps cache %s", caps_cache_file);
+    goto done;
+  }
+
+  GST_DEBUG ("no valid caps cache in %s, creating new one", caps_cache_file);
+  g_key_file_free (caps_cache);
+  caps_cache = g_key_file_new ();
+  g_key_file_set_integer (caps_cache, CAPS_CACHE_VERSION_GROUP, "avcodec",
+      avcodec_version ());
+  g_key_file_set_integer (caps_cache, CAPS_CACHE_VERSION_GROUP, "avformat",
+      avformat_version ());
+  g_key_file_set_string (caps_cache, CAPS_CACHE_VERSION_GROUP, "plugin",
+      PACKAGE_VERSION);
+  g_key_file_set_string (caps_cache, CAPS_CACHE_VERSION_GROUP, "file", stamp);
+  g_free (stamp);
+  caps_cache_dirty = TRUE;
+
+done:
+  g_static_mutex_unlock (&caps_cache_lock);
+}
+
+/* write the cache if something was added and release it, lookups done after
+ * this will simply miss */
+void
+gst_ffmpeg_caps_cache_finish (void)
+{
+  gchar *data, *dir;
+  gsize len;
+
+  g_static_mutex_lock (&caps_cache_lock);
+  if (!caps_cache)
+    goto done;
+
+  if (caps_cache_dirty) {
+    dir = g_path_get_dirname (caps_cache_file);
+    g_mkdir_with_parents (dir, 0755);
+    g_free (dir);
+
+    data = g_key_file_to_data (caps_cache, &len, NULL);
+    if (!data || !g_file_set_contents (caps_cache_file, data, len, NULL))
+      GST_DEBUG ("could not write caps cache %s", caps_cache_file);
+    g_free (data);
+  }
+
+  g_key_file_free (caps_cache);
+  caps_cache = NULL;
+  g_free (caps_cache_file);
+  caps_cache_file = NULL;
+
+done:
+  g_static_mutex_unlock (&caps_cache_lock);
+}
+
+/* returns TRUE and the caps in @caps (which can be NULL) when @key is in the
+ * cache */
+gboolean
+gst_ffmpeg_caps_cache_get (const gchar * key, GstCaps ** caps)
+{
+  gchar *str;
+
+  g_static_mutex_lock (&caps_cache_lock);
+  str = caps_cache ? g_key_file_get_string (caps_cache, CAPS_CACHE_GROUP, key,
+      NULL) : NULL;
+  g_static_mutex_unlock (&caps_cache_lock);
+
+  if (!str)
+    return FALSE;
+
+  *caps = (*str != '\0') ? gst_caps_from_string (str) : NULL;
+  g_free (str);
+
+  return TRUE;
+}
+
+void
+gst_ffmpeg_caps_cache_put (const gchar * key, const GstCaps * caps)
+{
+  gchar *str;
+
+  str = caps ? gst_caps_to_string (caps) : g_strdup ("");
+
+  g_static_mutex_lock (&caps_cache_lock);
+  if (caps_cache) {
+    g_key_file_set_string (caps_cache, CAPS_CACHE_GROUP, key, str);
+    caps_cache_dirty = TRUE;
+  }
+  g_static_mutex_unlock (&caps_cache_lock);
+
+  g_free (str);
+}
@@ -33,6 +33,12 @@
 int
 gst_ffmpeg_avpicture_get_size (int pix_fmt, int width, int height);
 
+/*
+ * Check if all components of a picture are stored in one plane
+ */
+gboolean
+gst_ffmpeg_avpicture_is_packed (int pix_fmt);
+
 /*
  * Fill in pointers in an AVPicture, aligned by 4 (required by X).
  */
@@ -90,4 +96,57 @@ av_smp_format_depth(enum SampleFormat smp_fmt);
 GstBuffer *
 new_aligned_buffer (gint size, GstCaps * caps);
 
+GstBuffer *
+gst_ffmpeg_packet_to_buffer (AVPacket * pkt);
+
+gboolean
+gst_ffmpeg_buffer_is_padded (GstBuffer * buf);
+
+/*
+ * Recycling pool of aligned buffers, used when downstream can't give us
+ * 16 byte aligned buffers. Buffers return their memory to the pool when
+ * they are freed, the pool is emptied when the size or caps change.
+ */
+typedef struct _GstFFMpegBufferPool GstFFMpegBufferPool;
+
+GstFFMpegBufferPool *
+gst_ffmpeg_buffer_pool_new (void);
+
+void
+gst_ffmpeg_buffer_pool_free (GstFFMpegBufferPool * pool);
+
+GstBuffer *
+gst_ffmpeg_buffer_pool_get (GstFFMpegBufferPool * pool, gint size,
+                            GstCaps * caps);
+
+void
+gst_ffmpeg_buffer_pool_flush (GstFFMpegBufferPool * pool);
+
+void
+gst_ffmpeg_buffer_pool_get_stats (GstFFMpegBufferPool * pool,
+                                  guint64 * hits, guint64 * misses);
+
+/*
+ * Upper bound on libavcodec worker threads, MAX_THREADS in mpegvideo.h
+ */
+#define GST_FFMPEG_MAX_THREADS 16
+
+gint
+gst_ffmpeg_auto_max_threads (void);
+
+/*
+ * Cache of the pad template caps, kept on disk between plugin loads
+ */
+void
+gst_ffmpeg_caps_cache_init (const gchar * plugin_file);
+
+void
+gst_ffmpeg_caps_cache_finish (void);
+
+gboolean
+gst_ffmpeg_caps_cache_get (const gchar * key, GstCaps ** caps);
+
+void
+gst_ffmpeg_caps_cache_put (const gchar * key, const GstCaps * caps);
+
 #endif /* __GST_FFMPEG_UTILS_H__ */
@@ -38,8 +38,36 @@
 #endif
 
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+typedef struct _GstFFMpegScale GstFFMpegScale;
 
-typedef struct _GstFFMpegScale
+/* A horizontal band of the output picture, scaled by its own context.
+ * The context scales a window of the picture that extends the band by a
+ * margin on both sides, so the filters see the same input lines as they
+ * would for the full picture. Only the band itself is copied out. */
+typedef struct
+{
+  GstFFMpegScale *scale;
+  struct SwsContext *ctx;
+
+  /* output lines of the band */
+  gint dst_y, dst_h;
+  /* window scaled by the context, in input and output lines */
+  gint win_src_y, win_src_h;
+  gint win_dst_y, win_dst_h;
+
+  /* output of the context */
+  guint8 *data;
+  gint stride[3], offset[3];
+
+  /* current frame */
+  guint8 *in, *out;
+} GstFFMpegScaleBand;
+
+struct _GstFFMpegScale
 {
   GstBaseTransform element;
 
@@ -50,6 +78,7 @@ typedef struct _GstFFMpegScale
   gint in_width, in_height;
   gint out_width, out_height;
 
+  GstVideoFormat in_format, out_format;
   enum PixelFormat in_pixfmt, out_pixfmt;
   struct SwsContext *ctx;
 
@@ -57,9 +86,17 @@ typedef struct _GstFFMpegScale
   gint in_stride[3], in_offset[3];
   gint out_stride[3], out_offset[3];
 
+  /* slice threading */
+  GstFFMpegScaleBand *bands;
+  gint n_bands;
+  GMutex *lock;
+  GCond *cond;
+  gint pending;
+
   /* property */
   gint method;
-} GstFFMpegScale;
+  guint threads;
+};
 
 typedef struct _GstFFMpegScaleClass
 {
@@ -123,6 +160,15 @@ static gint gst_ffmpegscale_method_flags[] = {
   SWS_SPLINE,
 };
 
+/* filter size of each method in input lines when downscaling by a factor
+ * of one, see initFilter() in libswscale */
+static gint gst_ffmpegscale_method_size[] = {
+  2, 2, 4, 8, 1, 2, 4, 8, 20, 6, 20
+};
+
+/* shared by all instances, runs the bands of the frames */
+static GThreadPool *band_pool = NULL;
+
 #define GST_TYPE_FFMPEGSCALE_METHOD (gst_ffmpegscale_method_get_type())
 static GType
 gst_ffmpegscale_method_get_type (void)
@@ -153,11 +199,16 @@ gst_ffmpegscale_method_get_type (void)
 }
 
 #define DEFAULT_PROP_METHOD    2
+#define DEFAULT_PROP_THREADS   1
+
+/* don't bother splitting bands smaller than this */
+#define MIN_BAND_LINES         16
 
 enum
 {
   PROP_0,
-  PROP_METHOD
+  PROP_METHOD,
+  PROP_THREADS
       /* FILL ME */
 };
 
@@ -214,6 +265,11 @@ gst_ffmpegscale_class_init (GstFFMpegScaleClass * klass)
       g_param_spec_enum ("method", "method", "method",
           GST_TYPE_FFMPEGSCALE_METHOD, DEFAULT_PROP_METHOD,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_THREADS,
+      g_param_spec_uint ("threads", "Threads",
+          "Number of horizontal bands scaled in parallel (0 = automatic)",
+          0, 64, DEFAULT_PROP_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   trans_class->stop = GST_DEBUG_FUNCPTR (gst_ffmpegscale_stop);
   trans_class->transform_caps =
@@ -235,9 +291,29 @@ gst_ffmpegscale_init (GstFFMpegScale * scale, GstFFMpegScaleClass * klass)
   gst_pad_set_event_function (trans->srcpad, gst_ffmpegscale_handle_src_event);
 
   scale->method = DEFAULT_PROP_METHOD;
+  scale->threads = DEFAULT_PROP_THREADS;
   scale->ctx = NULL;
   scale->in_pixfmt = PIX_FMT_NONE;
   scale->out_pixfmt = PIX_FMT_NONE;
+  scale->bands = NULL;
+  scale->n_bands = 0;
+  scale->lock = g_mutex_new ();
+  scale->cond = g_cond_new ();
+}
+
+static void
+gst_ffmpegscale_free_bands (GstFFMpegScale * scale)
+{
+  gint i;
+
+  for (i = 0; i < scale->n_bands; i++) {
+    if (scale->bands[i].ctx)
+      sws_freeContext (scale->bands[i].ctx);
+    av_free (scale->bands[i].data);
+  }
+  g_free (scale->bands);
+  scale->bands = NULL;
+  scale->n_bands = 0;
 }
 
 static void
@@ -247,6 +323,7 @@ gst_ffmpegscale_reset (GstFFMpegScale * scale)
     sws_freeContext (scale->ctx);
     scale->ctx = NULL;
   }
+  gst_ffmpegscale_free_bands (scale);
 
   scale->in_pixfmt = PIX_FMT_NONE;
   scale->out_pixfmt = PIX_FMT_NONE;
@@ -258,6 +335,8 @@ gst_ffmpegscale_finalize (GObject * object)
   GstFFMpegScale *scale = GST_FFMPEGSCALE (object);
 
   gst_ffmpegscale_reset (scale);
+  g_mutex_free (scale->lock);
+  g_cond_free (scale->cond);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -591,6 +670,134 @@ gst_ffmpegscale_fill_info (GstFFMpegScale * scale, GstVideoFormat format,
   }
 }
 
+static gint
+gst_ffmpegscale_get_n_threads (GstFFMpegScale * scale)
+{
+  gint n = scale->threads;
+
+  if (n == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+      n = 1;
+  }
+
+  return n;
+}
+
+/* log2 of the vertical chroma subsampling of format */
+static gint
+gst_ffmpegscale_chroma_v_shift (GstVideoFormat format)
+{
+  gint h;
+
+  if (!gst_video_format_is_yuv (format))
+    return 0;
+
+  /* chroma lines of an 8 line picture */
+  h = gst_video_format_get_component_height (format, 1, 8);
+
+  return h <= 2 ? 2 : (h <= 4 ? 1 : 0);
+}
+
+/* Splits the output in bands that are scaled by separate contexts. Window
+ * boundaries have to map to whole input lines, and they have to fall on a
+ * multiple of 8 output lines to keep subsampled chroma and the dither
+ * patterns aligned. libswscale rounds the vertical step to 1/65536 of a
+ * line, a band context starts at the exact input line of its window while
+ * the full picture context gets there in rounded steps. Both only agree,
+ * and the bands are only bit-exact with the full picture, when the step is
+ * exact, which is when the reduced output height q is a power of two. */
+static void
+gst_ffmpegscale_setup_bands (GstFFMpegScale * scale, gint swsflags)
+{
+  gint n_threads, g, p, q, align, margin, units, n, i, shift;
+
+  n_threads = gst_ffmpegscale_get_n_threads (scale);
+  if (n_threads < 2 || band_pool == NULL)
+    return;
+
+  /* output lines map to input lines in steps of q to p */
+  g = av_gcd (scale->in_height, scale->out_height);
+  p = scale->in_height / g;
+  q = scale->out_height / g;
+
+  if (q & (q - 1)) {
+    GST_DEBUG_OBJECT (scale, "not splitting, %d to %d lines is not an exact "
+        "vertical step", scale->in_height, scale->out_height);
+    return;
+  }
+
+  align = q * 8 / av_gcd (q, 8);
+  if ((align / q * p) & 1)
+    align *= 2;
+
+  /* lines the filter reaches beyond a band, in aligned output lines. The
+   * chroma filter has the same size in chroma lines, so with vertically
+   * subsampled chroma it reaches that much further in luma lines. */
+  shift = MAX (gst_ffmpegscale_chroma_v_shift (scale->in_format),
+      gst_ffmpegscale_chroma_v_shift (scale->out_format));
+  margin = ((gst_ffmpegscale_method_size[scale->method] / 2 + 2) << shift) *
+      ((p + q - 1) / q);
+  margin = MAX ((margin * q + p - 1) / p, MIN_BAND_LINES);
+  margin = (margin + align - 1) / align * align;
+
+  units = scale->out_height / align;
+  n = MIN (n_threads, units / (margin / align));
+  if (n < 2) {
+    GST_DEBUG_OBJECT (scale, "not splitting %d lines, alignment %d, margin %d",
+        scale->out_height, align, margin);
+    return;
+  }
+
+  scale->bands = g_new0 (GstFFMpegScaleBand, n);
+  scale->n_bands = n;
+
+  for (i = 0; i < n; i++) {
+    GstFFMpegScaleBand *band = &scale->bands[i];
+    gint end;
+
+    band->scale = scale;
+    band->dst_y = units * i / n * align;
+    end = (i == n - 1) ? scale->out_height : units * (i + 1) / n * align;
+    band->dst_h = end - band->dst_y;
+
+    band->win_dst_y = MAX (0, band->dst_y - margin);
+    end = MIN (scale->out_height, end + margin);
+    band->win_dst_h = end - band->win_dst_y;
+    band->win_src_y = band->win_dst_y / q * p;
+    band->win_src_h = end / q * p - band->win_src_y;
+
+    band->ctx = sws_getContext (scale->in_width, band->win_src_h,
+        scale->in_pixfmt, scale->out_width, band->win_dst_h,
+        scale->out_pixfmt, swsflags, NULL, NULL, NULL);
+    if (!band->ctx)
+      goto setup_failed;
+
+    gst_ffmpegscale_fill_info (scale, scale->out_format, scale->out_width,
+        band->win_dst_h, band->stride, band->offset);
+    band->data = av_malloc (gst_video_format_get_size (scale->out_format,
+            scale->out_width, band->win_dst_h));
+    if (!band->data)
+      goto setup_failed;
+
+    GST_DEBUG_OBJECT (scale, "band %d: lines %d+%d, window %d+%d from %d+%d",
+        i, band->dst_y, band->dst_h, band->win_dst_y, band->win_dst_h,
+        band->win_src_y, band->win_src_h);
+  }
+
+  return;
+
+  /* ERRORS */
+setup_failed:
+  {
+    GST_WARNING_OBJECT (scale, "failed to set up bands, not threading");
+    gst_ffmpegscale_free_bands (scale);
+    return;
+  }
+}
+
 static gboolean
 gst_ffmpegscale_set_caps (GstBaseTransform * trans, GstCaps * incaps,
     GstCaps * outcaps)
@@ -608,6 +815,7 @@ gst_ffmpegscale_set_caps (GstBaseTransform * trans, GstCaps * incaps,
     sws_freeContext (scale->ctx);
     scale->ctx = NULL;
   }
+  gst_ffmpegscale_free_bands (scale);
 
   ok = gst_video_format_parse_caps (incaps, &in_format, &scale->in_width,
       &scale->in_height);
@@ -622,6 +830,9 @@ gst_ffmpegscale_set_caps (GstBaseTransform * trans, GstCaps * incaps,
       out_format == GST_VIDEO_FORMAT_UNKNOWN)
     goto refuse_caps;
 
+  scale->in_format = in_format;
+  scale->out_format = out_format;
+
   GST_DEBUG_OBJECT (scale, "format %d => %d, from=%dx%d -> to=%dx%d", in_format,
       out_format, scale->in_width, scale->in_height, scale->out_width,
       scale->out_height);
@@ -645,13 +856,16 @@ gst_ffmpegscale_set_caps (GstBaseTransform * trans, GstCaps * incaps,
   swsflags = 0;
 #endif
 
+  swsflags |= gst_ffmpegscale_method_flags[scale->method];
 
   scale->ctx = sws_getContext (scale->in_width, scale->in_height,
       scale->in_pixfmt, scale->out_width, scale->out_height, scale->out_pixfmt,
-      swsflags | gst_ffmpegscale_method_flags[scale->method], NULL, NULL, NULL);
+      swsflags, NULL, NULL, NULL);
   if (!scale->ctx)
     goto setup_failed;
 
+  gst_ffmpegscale_setup_bands (scale, swsflags);
+
   return TRUE;
 
   /* ERRORS */
@@ -667,6 +881,60 @@ refuse_caps:
   }
 }
 
+static void
+gst_ffmpegscale_scale_band (GstFFMpegScaleBand * band)
+{
+  GstFFMpegScale *scale = band->scale;
+  GstVideoFormat in_format = scale->in_format;
+  GstVideoFormat out_format = scale->out_format;
+  guint8 *in_data[3] = { NULL, NULL, NULL };
+  guint8 *win_data[3] = { NULL, NULL, NULL };
+  gint i, line, win_line, lines;
+
+  for (i = 0; i < 3; i++) {
+    if (!i || scale->in_offset[i]) {
+      line = gst_video_format_get_component_height (in_format, i,
+          band->win_src_y);
+      in_data[i] = band->in + scale->in_offset[i] +
+          line * scale->in_stride[i];
+    }
+    if (!i || band->offset[i])
+      win_data[i] = band->data + band->offset[i];
+  }
+
+  sws_scale (band->ctx, (const guint8 **) in_data, scale->in_stride, 0,
+      band->win_src_h, win_data, band->stride);
+
+  /* the window has the same row strides as the output */
+  for (i = 0; i < 3; i++) {
+    if (i && !scale->out_offset[i])
+      continue;
+
+    line = gst_video_format_get_component_height (out_format, i, band->dst_y);
+    win_line = line -
+        gst_video_format_get_component_height (out_format, i, band->win_dst_y);
+    lines = gst_video_format_get_component_height (out_format, i,
+        band->dst_y + band->dst_h) - line;
+
+    memcpy (band->out + scale->out_offset[i] + line * scale->out_stride[i],
+        win_data[i] + win_line * band->stride[i], lines * band->stride[i]);
+  }
+}
+
+static void
+gst_ffmpegscale_band_func (gpointer data, gpointer user_data)
+{
+  GstFFMpegScaleBand *band = data;
+  GstFFMpegScale *scale = band->scale;
+
+  gst_ffmpegscale_scale_band (band);
+
+  g_mutex_lock (scale->lock);
+  if (--scale->pending == 0)
+    g_cond_signal (scale->cond);
+  g_mutex_unlock (scale->lock);
+}
+
 static GstFlowReturn
 gst_ffmpegscale_transform (GstBaseTransform * trans, GstBuffer * inbuf,
     GstBuffer * outbuf)
@@ -676,6 +944,26 @@ gst_ffmpegscale_transform (GstBaseTransform * trans, GstBuffer * inbuf,
   guint8 *out_data[3] = { NULL, NULL, NULL };
   gint i;
 
+  if (scale->n_bands > 1) {
+    scale->pending = scale->n_bands - 1;
+    for (i = 0; i < scale->n_bands; i++) {
+      scale->bands[i].in = GST_BUFFER_DATA (inbuf);
+      scale->bands[i].out = GST_BUFFER_DATA (outbuf);
+      if (i)
+        g_thread_pool_push (band_pool, &scale->bands[i], NULL);
+    }
+
+    /* do our share while the pool handles the others */
+    gst_ffmpegscale_scale_band (&scale->bands[0]);
+
+    g_mutex_lock (scale->lock);
+    while (scale->pending)
+      g_cond_wait (scale->cond, scale->lock);
+    g_mutex_unlock (scale->lock);
+
+    return GST_FLOW_OK;
+  }
+
   for (i = 0; i < 3; i++) {
     /* again; stay close to the ffmpeg offset way */
     if (!i || scale->in_offset[i])
@@ -748,6 +1036,9 @@ gst_ffmpegscale_set_property (GObject * object, guint prop_id,
     case PROP_METHOD:
       scale->method = g_value_get_enum (value);
       break;
+    case PROP_THREADS:
+      scale->threads = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -764,6 +1055,9 @@ gst_ffmpegscale_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_METHOD:
       g_value_set_enum (value, scale->method);
       break;
+    case PROP_THREADS:
+      g_value_set_uint (value, scale->threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -812,6 +1106,9 @@ plugin_init (GstPlugin * plugin)
   av_log_set_callback (gst_ffmpeg_log_callback);
 #endif
 
+  band_pool = g_thread_pool_new (gst_ffmpegscale_band_func, NULL, -1, FALSE,
+      NULL);
+
   return gst_element_register (plugin, "ffvideoscale",
       GST_RANK_NONE, GST_TYPE_FFMPEGSCALE);
 }
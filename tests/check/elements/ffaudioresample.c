@@ -0,0 +1,272 @@
+/* GStreamer unit tests for ffaudioresample
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include <math.h>
+
+#define IN_RATE 48000
+#define OUT_RATE 44100
+#define BUFFER_FRAMES 4800
+#define NUM_BUFFERS 10
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw-int, rate = (int) 44100; "
+        "audio/x-raw-float, rate = (int) 44100"));
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw-int; audio/x-raw-float"));
+
+static GstPad *mysrcpad, *mysinkpad;
+
+typedef struct
+{
+  const gchar *name;
+  gint width;
+  gboolean is_float;
+  /* amplitude of the test signal */
+  gdouble scale;
+} Format;
+
+static const Format formats[] = {
+  {"S16", 16, FALSE, 16384.0},
+  {"S32", 32, FALSE, 1073741824.0},
+  {"F32", 32, TRUE, 0.5}
+};
+
+static GstCaps *
+create_caps (const Format * format, gint channels)
+{
+  if (format->is_float)
+    return gst_caps_new_simple ("audio/x-raw-float",
+        "endianness", G_TYPE_INT, G_BYTE_ORDER,
+        "width", G_TYPE_INT, 32,
+        "channels", G_TYPE_INT, channels, "rate", G_TYPE_INT, IN_RATE, NULL);
+
+  return gst_caps_new_simple ("audio/x-raw-int",
+      "endianness", G_TYPE_INT, G_BYTE_ORDER,
+      "signed", G_TYPE_BOOLEAN, TRUE,
+      "width", G_TYPE_INT, format->width,
+      "depth", G_TYPE_INT, format->width,
+      "channels", G_TYPE_INT, channels, "rate", G_TYPE_INT, IN_RATE, NULL);
+}
+
+/* every channel gets its own frequency */
+static gdouble
+signal_value (gint channel, gdouble t)
+{
+  return sin (2 * G_PI * 440 * (channel + 1) * t);
+}
+
+static GstBuffer *
+create_buffer (const Format * format, gint channels, gint offset)
+{
+  GstBuffer *buffer;
+  gint i, c;
+
+  buffer = gst_buffer_new_and_alloc (BUFFER_FRAMES * channels *
+      format->width / 8);
+
+  for (i = 0; i < BUFFER_FRAMES; i++) {
+    for (c = 0; c < channels; c++) {
+      gdouble v = format->scale *
+          signal_value (c, (gdouble) (offset + i) / IN_RATE);
+      gint n = i * channels + c;
+
+      if (format->is_float)
+        ((gfloat *) GST_BUFFER_DATA (buffer))[n] = v;
+      else if (format->width == 32)
+        ((gint32 *) GST_BUFFER_DATA (buffer))[n] = rint (v);
+      else
+        ((gint16 *) GST_BUFFER_DATA (buffer))[n] = rint (v);
+    }
+  }
+
+  GST_BUFFER_TIMESTAMP (buffer) =
+      gst_util_uint64_scale_int (offset, GST_SECOND, IN_RATE);
+  GST_BUFFER_DURATION (buffer) =
+      gst_util_uint64_scale_int (BUFFER_FRAMES, GST_SECOND, IN_RATE);
+  if (offset == 0)
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+
+  return buffer;
+}
+
+static gdouble
+read_sample (const Format * format, GstBuffer * buffer, gint n)
+{
+  if (format->is_float)
+    return ((gfloat *) GST_BUFFER_DATA (buffer))[n];
+  else if (format->width == 32)
+    return ((gint32 *) GST_BUFFER_DATA (buffer))[n];
+  else
+    return ((gint16 *) GST_BUFFER_DATA (buffer))[n];
+}
+
+static GstElement *
+setup_resample (const Format * format, gint channels)
+{
+  GstElement *resample;
+  GstCaps *caps;
+
+  resample = gst_check_setup_element ("ffaudioresample");
+  mysrcpad = gst_check_setup_src_pad (resample, &srctemplate, NULL);
+  mysinkpad = gst_check_setup_sink_pad (resample, &sinktemplate, NULL);
+  gst_pad_set_active (mysrcpad, TRUE);
+  gst_pad_set_active (mysinkpad, TRUE);
+
+  fail_unless (gst_element_set_state (resample,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  caps = create_caps (format, channels);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  return resample;
+}
+
+static void
+cleanup_resample (GstElement * resample)
+{
+  gst_element_set_state (resample, GST_STATE_NULL);
+
+  g_list_foreach (buffers, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (buffers);
+  buffers = NULL;
+
+  gst_pad_set_active (mysrcpad, FALSE);
+  gst_pad_set_active (mysinkpad, FALSE);
+  gst_check_teardown_src_pad (resample);
+  gst_check_teardown_sink_pad (resample);
+  gst_check_teardown_element (resample);
+}
+
+static void
+push_buffers (const Format * format, gint channels, gint n_buffers)
+{
+  gint i;
+
+  for (i = 0; i < n_buffers; i++) {
+    GstBuffer *buffer = create_buffer (format, channels, i * BUFFER_FRAMES);
+
+    gst_buffer_set_caps (buffer, GST_PAD_CAPS (mysrcpad));
+    fail_unless_equals_int (gst_pad_push (mysrcpad, buffer), GST_FLOW_OK);
+  }
+}
+
+/* resamples a sine per channel and compares the output against the ideal
+ * signal at the output rate, also checks that the output timestamps follow
+ * the sample count */
+static void
+check_resample (const Format * format, gint channels)
+{
+  GstElement *resample;
+  gdouble signal = 0, noise = 0;
+  guint64 frames = 0;
+  GList *l;
+  gint i, c;
+
+  resample = setup_resample (format, channels);
+  push_buffers (format, channels, NUM_BUFFERS);
+
+  fail_unless (buffers != NULL);
+  for (l = buffers; l; l = l->next) {
+    GstBuffer *buffer = GST_BUFFER (l->data);
+    gint n = GST_BUFFER_SIZE (buffer) / (channels * format->width / 8);
+
+    fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer),
+        gst_util_uint64_scale_int (frames, GST_SECOND, OUT_RATE));
+
+    for (i = 0; i < n; i++) {
+      /* skip the filter's run-in */
+      if (frames + i < 64)
+        continue;
+      for (c = 0; c < channels; c++) {
+        gdouble ref = format->scale *
+            signal_value (c, (gdouble) (frames + i) / OUT_RATE);
+        gdouble v = read_sample (format, buffer, i * channels + c);
+
+        signal += ref * ref;
+        noise += (v - ref) * (v - ref);
+      }
+    }
+    frames += n;
+  }
+
+  /* all but a filter length of input comes out */
+  fail_unless (frames <= (guint64) NUM_BUFFERS * BUFFER_FRAMES * OUT_RATE /
+      IN_RATE);
+  fail_unless (frames + 64 >= (guint64) NUM_BUFFERS * BUFFER_FRAMES *
+      OUT_RATE / IN_RATE);
+
+  fail_unless (10 * log10 (signal / noise) > 70.0,
+      "%s with %d channels: SNR of %.1f dB", format->name, channels,
+      10 * log10 (signal / noise));
+
+  cleanup_resample (resample);
+}
+
+GST_START_TEST (test_s16)
+{
+  check_resample (&formats[0], 1);
+  check_resample (&formats[0], 2);
+  check_resample (&formats[0], 6);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_s32)
+{
+  check_resample (&formats[1], 1);
+  check_resample (&formats[1], 2);
+  check_resample (&formats[1], 6);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_f32)
+{
+  check_resample (&formats[2], 1);
+  check_resample (&formats[2], 2);
+  check_resample (&formats[2], 8);
+}
+
+GST_END_TEST;
+
+static Suite *
+ffaudioresample_suite (void)
+{
+  Suite *s = suite_create ("ffaudioresample");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_set_timeout (tc_chain, 60);
+
+  tcase_add_test (tc_chain, test_s16);
+  tcase_add_test (tc_chain, test_s32);
+  tcase_add_test (tc_chain, test_f32);
+
+  return s;
+}
+
+GST_CHECK_MAIN (ffaudioresample)
@@ -0,0 +1,401 @@
+/* GStreamer unit tests for ffdeinterlace
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#ifdef HAVE_FFMPEG_UNINSTALLED
+#  include <avcodec.h>
+#else
+#  include <libavcodec/avcodec.h>
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/video/video.h>
+
+#include <string.h>
+
+/* the lines of all planes end in a part of a 16 byte register */
+#define WIDTH 360
+#define HEIGHT 240
+
+/* same as in the element */
+#define MOTION_THRESHOLD 10
+
+#define VIDEO_CAPS_TEMPLATE_STRING "video/x-raw-yuv, format = (fourcc) I420"
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (VIDEO_CAPS_TEMPLATE_STRING));
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (VIDEO_CAPS_TEMPLATE_STRING));
+
+static GstPad *mysrcpad, *mysinkpad;
+
+static GstCaps *
+create_caps (gint width, gint height)
+{
+  return gst_caps_new_simple ("video/x-raw-yuv",
+      "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC ('I', '4', '2', '0'),
+      "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+      "framerate", GST_TYPE_FRACTION, 25, 1,
+      "interlaced", G_TYPE_BOOLEAN, TRUE, NULL);
+}
+
+static GstBuffer *
+create_frame (GRand * rand, gint width, gint height)
+{
+  GstBuffer *buffer;
+  guint i, size;
+
+  size = width * height * 3 / 2;
+  buffer = gst_buffer_new_and_alloc (size);
+  for (i = 0; i < size; i++)
+    GST_BUFFER_DATA (buffer)[i] = g_rand_int_range (rand, 0, 256);
+
+  return buffer;
+}
+
+static GstElement *
+setup_deinterlace (const gchar * mode, gboolean field_rate, gint width,
+    gint height)
+{
+  GstElement *deinterlace;
+  GstCaps *caps;
+
+  deinterlace = gst_check_setup_element ("ffdeinterlace");
+  gst_util_set_object_arg (G_OBJECT (deinterlace), "mode", mode);
+  g_object_set (deinterlace, "field-rate", field_rate, NULL);
+  mysrcpad = gst_check_setup_src_pad (deinterlace, &srctemplate, NULL);
+  mysinkpad = gst_check_setup_sink_pad (deinterlace, &sinktemplate, NULL);
+  gst_pad_set_active (mysrcpad, TRUE);
+  gst_pad_set_active (mysinkpad, TRUE);
+
+  fail_unless (gst_element_set_state (deinterlace,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  caps = create_caps (width, height);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+
+  return deinterlace;
+}
+
+static void
+cleanup_deinterlace (GstElement * deinterlace)
+{
+  gst_element_set_state (deinterlace, GST_STATE_NULL);
+
+  g_list_foreach (buffers, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (buffers);
+  buffers = NULL;
+
+  gst_pad_set_active (mysrcpad, FALSE);
+  gst_pad_set_active (mysinkpad, FALSE);
+  gst_check_teardown_src_pad (deinterlace);
+  gst_check_teardown_sink_pad (deinterlace);
+  gst_check_teardown_element (deinterlace);
+}
+
+static void
+push_frame (GstBuffer * frame, GstClockTime timestamp)
+{
+  GstBuffer *buffer = gst_buffer_copy (frame);
+
+  GST_BUFFER_TIMESTAMP (buffer) = timestamp;
+  GST_BUFFER_DURATION (buffer) = GST_SECOND / 25;
+  GST_BUFFER_FLAG_SET (buffer, GST_VIDEO_BUFFER_TFF);
+  gst_buffer_set_caps (buffer, GST_PAD_CAPS (mysrcpad));
+  fail_unless_equals_int (gst_pad_push (mysrcpad, buffer), GST_FLOW_OK);
+}
+
+GST_START_TEST (test_field_rate)
+{
+  GstElement *deinterlace;
+  GstStructure *structure;
+  GstBuffer *frame;
+  GRand *rand;
+  GList *l;
+  gint i, n, d;
+  gboolean interlaced;
+
+  rand = g_rand_new_with_seed (0x5eed);
+  frame = create_frame (rand, 320, 240);
+
+  deinterlace = setup_deinterlace ("interpolate", TRUE, 320, 240);
+  for (i = 0; i < 3; i++)
+    push_frame (frame, i * GST_SECOND / 25);
+
+  fail_unless_equals_int (g_list_length (buffers), 6);
+
+  structure = gst_caps_get_structure (GST_PAD_CAPS (mysinkpad), 0);
+  fail_unless (gst_structure_get_fraction (structure, "framerate", &n, &d));
+  fail_unless_equals_int (n, 50);
+  fail_unless_equals_int (d, 1);
+  fail_unless (gst_structure_get_boolean (structure, "interlaced",
+          &interlaced));
+  fail_if (interlaced);
+
+  for (l = buffers, i = 0; l; l = l->next, i++) {
+    GstBuffer *buffer = GST_BUFFER (l->data);
+
+    fail_unless_equals_uint64 (GST_BUFFER_TIMESTAMP (buffer),
+        i * GST_SECOND / 50);
+    fail_unless_equals_uint64 (GST_BUFFER_DURATION (buffer),
+        GST_SECOND / 50);
+  }
+
+  cleanup_deinterlace (deinterlace);
+  gst_buffer_unref (frame);
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+/* the kept field is not touched, lines of the other field change */
+GST_START_TEST (test_interpolate_keeps_field)
+{
+  GstElement *deinterlace;
+  GstBuffer *frame, *out;
+  GRand *rand;
+  gint y;
+
+  rand = g_rand_new_with_seed (0x5eed);
+  frame = create_frame (rand, 320, 240);
+
+  deinterlace = setup_deinterlace ("interpolate", FALSE, 320, 240);
+  push_frame (frame, 0);
+  fail_unless_equals_int (g_list_length (buffers), 1);
+
+  out = GST_BUFFER (buffers->data);
+  fail_unless_equals_int (GST_BUFFER_SIZE (out), GST_BUFFER_SIZE (frame));
+  for (y = 0; y < 240; y += 2) {
+    fail_unless (memcmp (GST_BUFFER_DATA (out) + y * 320,
+            GST_BUFFER_DATA (frame) + y * 320, 320) == 0);
+  }
+  fail_if (memcmp (GST_BUFFER_DATA (out) + 320,
+          GST_BUFFER_DATA (frame) + 320, 320) == 0);
+
+  cleanup_deinterlace (deinterlace);
+  gst_buffer_unref (frame);
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+/* a static picture is woven back together from the second frame on */
+GST_START_TEST (test_motion_adaptive_static)
+{
+  GstElement *deinterlace;
+  GstBuffer *frame, *out;
+  GRand *rand;
+
+  rand = g_rand_new_with_seed (0x5eed);
+  frame = create_frame (rand, 320, 240);
+
+  deinterlace = setup_deinterlace ("motion-adaptive", FALSE, 320, 240);
+  push_frame (frame, 0);
+  push_frame (frame, GST_SECOND / 25);
+  fail_unless_equals_int (g_list_length (buffers), 2);
+
+  out = GST_BUFFER (buffers->data);
+  fail_if (memcmp (GST_BUFFER_DATA (out), GST_BUFFER_DATA (frame),
+          GST_BUFFER_SIZE (frame)) == 0);
+  out = GST_BUFFER (buffers->next->data);
+  fail_unless (memcmp (GST_BUFFER_DATA (out), GST_BUFFER_DATA (frame),
+          GST_BUFFER_SIZE (frame)) == 0);
+
+  cleanup_deinterlace (deinterlace);
+  gst_buffer_unref (frame);
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+/* the lowpass mode gives the same result as avpicture_deinterlace() */
+GST_START_TEST (test_lowpass_avpicture)
+{
+  GstElement *deinterlace;
+  GstBuffer *frame, *out;
+  AVPicture picture;
+  GRand *rand;
+  guint8 *ref;
+
+  rand = g_rand_new_with_seed (0x5eed);
+  frame = create_frame (rand, WIDTH, HEIGHT);
+
+  ref = g_memdup (GST_BUFFER_DATA (frame), GST_BUFFER_SIZE (frame));
+  avpicture_fill (&picture, ref, PIX_FMT_YUV420P, WIDTH, HEIGHT);
+  fail_unless_equals_int (avpicture_deinterlace (&picture, &picture,
+          PIX_FMT_YUV420P, WIDTH, HEIGHT), 0);
+
+  deinterlace = setup_deinterlace ("lowpass", FALSE, WIDTH, HEIGHT);
+  push_frame (frame, 0);
+  fail_unless_equals_int (g_list_length (buffers), 1);
+
+  out = GST_BUFFER (buffers->data);
+  fail_unless_equals_int (GST_BUFFER_SIZE (out), GST_BUFFER_SIZE (frame));
+  fail_unless (memcmp (GST_BUFFER_DATA (out), ref, GST_BUFFER_SIZE (out)) ==
+      0);
+
+  cleanup_deinterlace (deinterlace);
+  g_free (ref);
+  gst_buffer_unref (frame);
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+/* a second frame with pixels that don't move, move by just the threshold
+ * and move by more than that */
+static GstBuffer *
+create_moved_frame (GRand * rand, GstBuffer * frame)
+{
+  GstBuffer *buffer;
+  guint i;
+
+  buffer = gst_buffer_copy (frame);
+  for (i = 0; i < GST_BUFFER_SIZE (buffer); i++) {
+    guint8 *p = GST_BUFFER_DATA (buffer) + i;
+    gint d;
+
+    switch (g_rand_int_range (rand, 0, 4)) {
+      case 0:
+        continue;
+      case 1:
+        d = MOTION_THRESHOLD;
+        break;
+      case 2:
+        d = MOTION_THRESHOLD + 1;
+        break;
+      default:
+        *p = g_rand_int_range (rand, 0, 256);
+        continue;
+    }
+    *p = *p < 128 ? *p + d : *p - d;
+  }
+
+  return buffer;
+}
+
+/* what the C kernels make of the bottom field of a plane */
+static void
+reference_plane (guint8 * dest, const guint8 * src, const guint8 * prev,
+    gint width, gint height)
+{
+  gint x, y, last = height - 2;
+
+  memcpy (dest, src, width * height);
+
+#define KEPT(l) (CLAMP ((l), 0, last) * width + x)
+  for (y = 1; y < height; y += 2) {
+    for (x = 0; x < width; x++) {
+      gint m1 = src[KEPT (y - 1)], p1 = src[KEPT (y + 1)];
+      gint sum = 9 * (m1 + p1) - src[KEPT (y - 3)] - src[KEPT (y + 3)];
+
+      if (prev && ABS (m1 - prev[KEPT (y - 1)]) <= MOTION_THRESHOLD &&
+          ABS (p1 - prev[KEPT (y + 1)]) <= MOTION_THRESHOLD)
+        continue;
+      dest[y * width + x] = CLAMP ((sum + 8) >> 4, 0, 255);
+    }
+  }
+#undef KEPT
+}
+
+static void
+check_reference (GstBuffer * out, GstBuffer * frame, GstBuffer * prev)
+{
+  guint8 *ref;
+  gint luma = WIDTH * HEIGHT, chroma = luma / 4;
+
+  fail_unless_equals_int (GST_BUFFER_SIZE (out), GST_BUFFER_SIZE (frame));
+
+  ref = g_malloc (GST_BUFFER_SIZE (frame));
+  reference_plane (ref, GST_BUFFER_DATA (frame),
+      prev ? GST_BUFFER_DATA (prev) : NULL, WIDTH, HEIGHT);
+  reference_plane (ref + luma, GST_BUFFER_DATA (frame) + luma,
+      prev ? GST_BUFFER_DATA (prev) + luma : NULL, WIDTH / 2, HEIGHT / 2);
+  reference_plane (ref + luma + chroma,
+      GST_BUFFER_DATA (frame) + luma + chroma,
+      prev ? GST_BUFFER_DATA (prev) + luma + chroma : NULL, WIDTH / 2,
+      HEIGHT / 2);
+
+  fail_unless (memcmp (GST_BUFFER_DATA (out), ref, GST_BUFFER_SIZE (out)) ==
+      0);
+  g_free (ref);
+}
+
+/* The element uses the SSE2 kernels on CPUs that have them. They have to
+ * give the same output as the C kernels, also for the ends of lines that
+ * don't fill a whole register. */
+GST_START_TEST (test_kernels_reference)
+{
+  GstElement *deinterlace;
+  GstBuffer *frames[2];
+  GRand *rand;
+
+  rand = g_rand_new_with_seed (0x5eed);
+  frames[0] = create_frame (rand, WIDTH, HEIGHT);
+  frames[1] = create_moved_frame (rand, frames[0]);
+
+  deinterlace = setup_deinterlace ("interpolate", FALSE, WIDTH, HEIGHT);
+  push_frame (frames[0], 0);
+  fail_unless_equals_int (g_list_length (buffers), 1);
+  check_reference (GST_BUFFER (buffers->data), frames[0], NULL);
+  cleanup_deinterlace (deinterlace);
+
+  deinterlace = setup_deinterlace ("motion-adaptive", FALSE, WIDTH, HEIGHT);
+  push_frame (frames[0], 0);
+  push_frame (frames[1], GST_SECOND / 25);
+  fail_unless_equals_int (g_list_length (buffers), 2);
+  check_reference (GST_BUFFER (buffers->data), frames[0], NULL);
+  check_reference (GST_BUFFER (buffers->next->data), frames[1], frames[0]);
+  cleanup_deinterlace (deinterlace);
+
+  gst_buffer_unref (frames[0]);
+  gst_buffer_unref (frames[1]);
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+static Suite *
+ffdeinterlace_suite (void)
+{
+  Suite *s = suite_create ("ffdeinterlace");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_set_timeout (tc_chain, 60);
+
+  tcase_add_test (tc_chain, test_field_rate);
+  tcase_add_test (tc_chain, test_interpolate_keeps_field);
+  tcase_add_test (tc_chain, test_motion_adaptive_static);
+  tcase_add_test (tc_chain, test_lowpass_avpicture);
+  tcase_add_test (tc_chain, test_kernels_reference);
+
+  return s;
+}
+
+GST_CHECK_MAIN (ffdeinterlace)
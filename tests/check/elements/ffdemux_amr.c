@@ -0,0 +1,228 @@
+/* GStreamer unit tests for ffdemux_amr
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+#include <glib/gstdio.h>
+
+#include <string.h>
+#include <unistd.h>
+
+/* 12.2 kbit/s frames of 20 ms, a toc byte and 31 bytes of speech data */
+#define AMR_FRAME_SIZE 32
+#define AMR_TOC_12_2 0x3c
+#define NUM_FRAMES 250
+
+static volatile gint n_buffers;
+
+/* writes 5 seconds of silent AMR-NB to a temporary file */
+static gchar *
+create_amr_file (void)
+{
+  GError *err = NULL;
+  gchar *path, *data;
+  gsize header, size;
+  gint fd, i;
+
+  fd = g_file_open_tmp ("ffdemux-XXXXXX.amr", &path, &err);
+  fail_unless (fd >= 0, "could not create a temporary file: %s",
+      err ? err->message : "");
+  close (fd);
+
+  header = strlen ("#!AMR\n");
+  size = header + NUM_FRAMES * AMR_FRAME_SIZE;
+  data = g_malloc0 (size);
+  memcpy (data, "#!AMR\n", header);
+  for (i = 0; i < NUM_FRAMES; i++)
+    data[header + i * AMR_FRAME_SIZE] = AMR_TOC_12_2;
+
+  fail_unless (g_file_set_contents (path, data, size, &err),
+      "could not write %s: %s", path, err ? err->message : "");
+  g_free (data);
+
+  return path;
+}
+
+static void
+pad_added_cb (GstElement * demux, GstPad * pad, GstBin * pipeline)
+{
+  GstElement *sink;
+
+  sink = gst_bin_get_by_name (pipeline, "fakesink");
+  fail_unless (gst_element_link (demux, sink));
+  gst_object_unref (sink);
+}
+
+static void
+handoff_cb (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer user_data)
+{
+  g_atomic_int_inc (&n_buffers);
+}
+
+static gboolean
+wait_for_buffers (GstBus * bus)
+{
+  GstMessage *msg;
+  gint i;
+
+  for (i = 0; i < 100 && g_atomic_int_get (&n_buffers) == 0; i++) {
+    msg = gst_bus_poll (bus, GST_MESSAGE_ERROR, GST_SECOND / 20);
+    if (msg) {
+      GError *err = NULL;
+      gchar *dbg = NULL;
+
+      gst_message_parse_error (msg, &err, &dbg);
+      fail ("ERROR: %s\n%s", err->message, dbg);
+    }
+  }
+
+  return g_atomic_int_get (&n_buffers) > 0;
+}
+
+/* With stream queues the flush-stop of a flushing seek has to reach the
+ * source pads while their queues are still flushing, otherwise downstream
+ * stays flushing and nothing arrives after the seek. */
+GST_START_TEST (test_flushing_seek_stream_queues)
+{
+  GstElement *pipeline, *src, *demux, *sink;
+  GstStateChangeReturn ret;
+  GstBus *bus;
+  gchar *path;
+
+  path = create_amr_file ();
+
+  pipeline = gst_pipeline_new ("pipeline");
+  src = gst_element_factory_make ("filesrc", "filesrc");
+  demux = gst_element_factory_make ("ffdemux_amr", "demux");
+  sink = gst_element_factory_make ("fakesink", "fakesink");
+  fail_unless (pipeline && src && demux && sink);
+
+  g_object_set (src, "location", path, NULL);
+  g_object_set (demux, "stream-queues", TRUE, NULL);
+  g_object_set (sink, "sync", TRUE, "signal-handoffs", TRUE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, demux, sink, NULL);
+  fail_unless (gst_element_link (src, demux));
+  g_signal_connect (demux, "pad-added", G_CALLBACK (pad_added_cb), pipeline);
+  g_signal_connect (sink, "handoff", G_CALLBACK (handoff_cb), NULL);
+
+  bus = gst_element_get_bus (pipeline);
+
+  n_buffers = 0;
+  ret = gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  fail_unless (ret != GST_STATE_CHANGE_FAILURE);
+  fail_unless (wait_for_buffers (bus), "no buffers before the seek");
+
+  fail_unless (gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+          GST_SEEK_FLAG_FLUSH, GST_SECOND));
+  g_atomic_int_set (&n_buffers, 0);
+  fail_unless (wait_for_buffers (bus), "no buffers after the seek");
+
+  fail_unless_equals_int (gst_element_set_state (pipeline, GST_STATE_NULL),
+      GST_STATE_CHANGE_SUCCESS);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+GST_END_TEST;
+
+static void
+run_to_eos (const gchar * path, guint cache_blocks, guint64 * hits,
+    guint64 * misses)
+{
+  GstElement *pipeline, *src, *demux, *sink;
+  GstMessage *msg;
+  GstBus *bus;
+
+  pipeline = gst_pipeline_new ("pipeline");
+  src = gst_element_factory_make ("filesrc", "filesrc");
+  demux = gst_element_factory_make ("ffdemux_amr", "demux");
+  sink = gst_element_factory_make ("fakesink", "fakesink");
+  fail_unless (pipeline && src && demux && sink);
+
+  g_object_set (src, "location", path, NULL);
+  g_object_set (demux, "cache-blocks", cache_blocks, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, demux, sink, NULL);
+  fail_unless (gst_element_link (src, demux));
+  g_signal_connect (demux, "pad-added", G_CALLBACK (pad_added_cb), pipeline);
+
+  fail_unless (gst_element_set_state (pipeline,
+          GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_poll (bus, GST_MESSAGE_EOS | GST_MESSAGE_ERROR, -1);
+  fail_unless (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  g_object_get (demux, "cache-hits", hits, "cache-misses", misses, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+
+/* the demuxer pulls from filesrc, the whole file fits in one block so only
+ * the first read misses the read-ahead cache */
+GST_START_TEST (test_read_cache_stats)
+{
+  guint64 hits, misses;
+  gchar *path;
+
+  path = create_amr_file ();
+
+  run_to_eos (path, 8, &hits, &misses);
+  GST_DEBUG ("%" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses",
+      hits, misses);
+  fail_unless_equals_int (misses, 1);
+  fail_unless (hits > 0);
+
+  /* no cache, no statistics */
+  run_to_eos (path, 0, &hits, &misses);
+  fail_unless (hits == 0 && misses == 0);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+GST_END_TEST;
+
+static Suite *
+ffdemux_amr_suite (void)
+{
+  Suite *s = suite_create ("ffdemux_amr");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+
+  /* only run this if the amr demuxer was built */
+  if (gst_default_registry_check_feature_version ("ffdemux_amr",
+          GST_VERSION_MAJOR, GST_VERSION_MINOR, 0)) {
+    tcase_add_test (tc_chain, test_flushing_seek_stream_queues);
+    tcase_add_test (tc_chain, test_read_cache_stats);
+  } else {
+    g_print ("******* Skipping ffdemux_amr tests, demuxer not available\n");
+  }
+
+  return s;
+}
+
+GST_CHECK_MAIN (ffdemux_amr)
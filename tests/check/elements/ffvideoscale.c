@@ -0,0 +1,170 @@
+/* GStreamer unit tests for ffvideoscale
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include <string.h>
+
+#define NUM_FRAMES 2
+
+typedef struct
+{
+  gint in_width, in_height;
+  gint out_width, out_height;
+} Scale;
+
+/* the first three have an exact vertical step and are split in bands, the
+ * last one is scaled as a whole picture */
+static const Scale scales[] = {
+  {1920, 1080, 1280, 720},
+  {720, 576, 720, 1152},
+  {720, 576, 360, 288},
+  {720, 576, 1920, 1080}
+};
+
+static const gchar *formats[] = { "I420", "YUY2", NULL };
+
+static const gchar *methods[] = {
+  "bicubic", "lanczos", "sincr", "bicubic-spline", NULL
+};
+
+static const gchar *patterns[] = { "smpte", "checkers-8", NULL };
+
+static void
+handoff_cb (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    GList ** result)
+{
+  *result = g_list_append (*result, gst_buffer_ref (buffer));
+}
+
+/* scales NUM_FRAMES test frames and returns the output buffers */
+static GList *
+run_scale (const Scale * scale, const gchar * format, const gchar * method,
+    const gchar * pattern, guint threads)
+{
+  GstElement *pipeline, *sink;
+  GstMessage *msg;
+  GList *result = NULL;
+  GstBus *bus;
+  gchar *descr;
+
+  descr = g_strdup_printf ("videotestsrc num-buffers=%d pattern=%s ! "
+      "video/x-raw-yuv,format=(fourcc)%s,width=%d,height=%d ! "
+      "ffvideoscale method=%s threads=%u ! "
+      "video/x-raw-yuv,width=%d,height=%d ! "
+      "fakesink name=sink signal-handoffs=true", NUM_FRAMES, pattern, format,
+      scale->in_width, scale->in_height, method, threads, scale->out_width,
+      scale->out_height);
+  pipeline = gst_parse_launch (descr, NULL);
+  fail_unless (GST_IS_PIPELINE (pipeline), "could not create %s", descr);
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_signal_connect (sink, "handoff", G_CALLBACK (handoff_cb), &result);
+  gst_object_unref (sink);
+
+  fail_unless (gst_element_set_state (pipeline,
+          GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_poll (bus, GST_MESSAGE_EOS | GST_MESSAGE_ERROR, -1);
+  fail_unless (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS,
+      "error running %s", descr);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_free (descr);
+
+  fail_unless_equals_int (g_list_length (result), NUM_FRAMES);
+
+  return result;
+}
+
+static void
+free_buffers (GList * list)
+{
+  g_list_foreach (list, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (list);
+}
+
+/* scaling in bands gives the same output as scaling the whole picture */
+GST_START_TEST (test_threads_bitexact)
+{
+  gint s, f, m, p;
+
+  for (s = 0; s < G_N_ELEMENTS (scales); s++) {
+    for (f = 0; formats[f]; f++) {
+      for (m = 0; methods[m]; m++) {
+        for (p = 0; patterns[p]; p++) {
+          GList *ref, *out, *l, *k;
+          guint threads;
+
+          ref = run_scale (&scales[s], formats[f], methods[m], patterns[p],
+              1);
+
+          for (threads = 2; threads <= 4; threads *= 2) {
+            out = run_scale (&scales[s], formats[f], methods[m], patterns[p],
+                threads);
+
+            for (l = ref, k = out; l && k; l = l->next, k = k->next) {
+              GstBuffer *a = GST_BUFFER (l->data), *b = GST_BUFFER (k->data);
+
+              fail_unless_equals_int (GST_BUFFER_SIZE (a),
+                  GST_BUFFER_SIZE (b));
+              fail_unless (memcmp (GST_BUFFER_DATA (a), GST_BUFFER_DATA (b),
+                      GST_BUFFER_SIZE (a)) == 0,
+                  "%dx%d -> %dx%d %s %s %s with %u threads differs",
+                  scales[s].in_width, scales[s].in_height,
+                  scales[s].out_width, scales[s].out_height, formats[f],
+                  methods[m], patterns[p], threads);
+            }
+            free_buffers (out);
+          }
+          free_buffers (ref);
+        }
+      }
+    }
+  }
+}
+
+GST_END_TEST;
+
+static Suite *
+ffvideoscale_suite (void)
+{
+  Suite *s = suite_create ("ffvideoscale");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_set_timeout (tc_chain, 300);
+
+  /* only run this if the scaler and the test source are available */
+  if (gst_default_registry_check_feature_version ("ffvideoscale",
+          GST_VERSION_MAJOR, GST_VERSION_MINOR, 0) &&
+      gst_default_registry_check_feature_version ("videotestsrc",
+          GST_VERSION_MAJOR, GST_VERSION_MINOR, 0)) {
+    tcase_add_test (tc_chain, test_threads_bitexact);
+  } else {
+    g_print ("******* Skipping ffvideoscale tests, elements not available\n");
+  }
+
+  return s;
+}
+
+GST_CHECK_MAIN (ffvideoscale)
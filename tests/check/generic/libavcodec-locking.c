@@ -25,6 +25,7 @@
 #include <stdlib.h>
 
 #define NUM_SINKS 10
+#define NUM_PIPELINES 32
 
 static GstElement *
 setup_pipeline (const gchar * pipe_descr)
@@ -126,6 +127,82 @@ GST_START_TEST (test_libavcodec_locks)
 
 GST_END_TEST;
 
+/* Start NUM_PIPELINES encoder/decoder pipelines at the same time and check
+ * that all of them preroll. Prerolling opens both the encoder and the
+ * decoder, so all threads contend for the libavcodec lock at once. */
+typedef struct
+{
+  GMutex *lock;
+  GCond *cond;
+  gboolean go;
+  gboolean ok;
+} OpenContention;
+
+static gpointer
+open_contention_thread (gpointer data)
+{
+  OpenContention *contention = data;
+  GstElement *pipeline;
+  GstStateChangeReturn ret;
+
+  pipeline = setup_pipeline ("videotestsrc num-buffers=1 ! "
+      "video/x-raw-yuv,format=(fourcc)I420,width=320,height=240 ! "
+      "ffenc_mpeg4 ! ffdec_mpeg4 ! fakesink");
+
+  g_mutex_lock (contention->lock);
+  while (!contention->go)
+    g_cond_wait (contention->cond, contention->lock);
+  g_mutex_unlock (contention->lock);
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  ret = gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+  contention->ok = (ret == GST_STATE_CHANGE_SUCCESS);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return NULL;
+}
+
+GST_START_TEST (test_libavcodec_open_contention)
+{
+  OpenContention contention[NUM_PIPELINES];
+  GThread *threads[NUM_PIPELINES];
+  GMutex *lock;
+  GCond *cond;
+  gint i;
+
+  lock = g_mutex_new ();
+  cond = g_cond_new ();
+
+  for (i = 0; i < NUM_PIPELINES; i++) {
+    contention[i].lock = lock;
+    contention[i].cond = cond;
+    contention[i].go = FALSE;
+    contention[i].ok = FALSE;
+    threads[i] = g_thread_create (open_contention_thread, &contention[i],
+        TRUE, NULL);
+    fail_unless (threads[i] != NULL);
+  }
+
+  /* release all threads at once */
+  g_mutex_lock (lock);
+  for (i = 0; i < NUM_PIPELINES; i++)
+    contention[i].go = TRUE;
+  g_cond_broadcast (cond);
+  g_mutex_unlock (lock);
+
+  for (i = 0; i < NUM_PIPELINES; i++) {
+    g_thread_join (threads[i]);
+    fail_unless (contention[i].ok, "pipeline %d failed to preroll", i);
+  }
+
+  g_cond_free (cond);
+  g_mutex_free (lock);
+}
+
+GST_END_TEST;
+
 static Suite *
 simple_launch_lines_suite (void)
 {
@@ -150,6 +227,7 @@ simple_launch_lines_suite (void)
   if (gst_default_registry_check_feature_version ("ffenc_mpeg4",
           GST_VERSION_MAJOR, GST_VERSION_MINOR, 0)) {
     tcase_add_test (tc_chain, test_libavcodec_locks);
+    tcase_add_test (tc_chain, test_libavcodec_open_contention);
   } else {
     g_print ("******* Skipping libavcodec_locks test, no encoder available\n");
   }